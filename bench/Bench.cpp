@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+
+#include "Bench.hpp"
+
+void Timer::start() {
+  begin = std::chrono::steady_clock::now();
+}
+
+void Timer::stop() {
+  total += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+double Timer::seconds() const {
+  return total;
+}
+
+Bench::Bench(int samples, double minTime, const std::string& filter)
+  : samples(std::max(samples, 1)), minTime(minTime), filter(filter) {
+  printf("%-44s %12s %14s %8s\n", "case", "ns/op", "items/s", "spread");
+}
+
+double Bench::run(const std::string& name, uint64_t ops, uint64_t items, const Case& body) {
+  if (name.find(filter) == std::string::npos) return 0.0;
+
+  // Warm up and find how many iterations make a sample long enough
+  uint64_t iterations = 1;
+  for (;;) {
+    Timer timer;
+    body(iterations, timer);
+    double t = timer.seconds();
+    if (t >= minTime || iterations >= (1ull << 40)) break;
+
+    uint64_t factor = t > 0.0 ? static_cast<uint64_t>(std::min(minTime / t * 1.2, 100.0)) : 100;
+    iterations *= std::max<uint64_t>(factor, 2);
+  }
+
+  std::vector<double> seconds(samples);
+  for (double& s : seconds) {
+    Timer timer;
+    body(iterations, timer);
+    s = timer.seconds();
+  }
+  std::sort(seconds.begin(), seconds.end());
+
+  double median = seconds[samples / 2];
+  Result r{
+    name,
+    median / (iterations * ops) * 1e9,
+    iterations * items / median,
+    (seconds.back() - seconds.front()) / median
+  };
+  results.push_back(r);
+
+  printf("%-44s %12.2f %14.4g %7.1f%%\n", r.name.c_str(), r.nsPerOp, r.itemsPerSecond, r.spread * 100.0);
+  fflush(stdout);
+  return r.nsPerOp;
+}
+
+void Bench::save(const char* path) const {
+  std::ofstream file(path);
+  for (const Result& r : results)
+    file << r.name << ' ' << r.nsPerOp << '\n';
+
+  printf("Baseline of %zu cases saved to %s\n", results.size(), path);
+}
+
+int Bench::compare(const char* path, double tolerance) const {
+  std::ifstream file(path);
+  if (!file) {
+    printf("No baseline at %s\n", path);
+    return 1;
+  }
+
+  std::map<std::string, double> baseline;
+  std::string name;
+  double ns;
+  while (file >> name >> ns) baseline[name] = ns;
+
+  int slower = 0;
+  printf("\n%-44s %12s %12s %8s\n", "case", "baseline", "now", "change");
+  for (const Result& r : results) {
+    auto it = baseline.find(r.name);
+    if (it == baseline.end()) continue;
+
+    double change = (r.nsPerOp / it->second - 1.0) * 100.0;
+    bool regression = change > tolerance;
+    slower += regression;
+    printf("%-44s %12.2f %12.2f %+7.1f%%%s\n", r.name.c_str(), it->second, r.nsPerOp, change, regression ? "  SLOWER" : "");
+  }
+
+  printf("%d case(s) slower than %.0f%%\n", slower, tolerance);
+  return slower ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Accumulates only the parts of an iteration that are measured
+class Timer {
+  public:
+    void start();
+    void stop();
+    [[nodiscard]] double seconds() const;
+
+  private:
+    std::chrono::steady_clock::time_point begin;
+    double total = 0.0;
+};
+
+// Runs every case until a sample takes long enough to time, repeats the samples and keeps the median.
+// Results can be saved as a baseline and later compared against it.
+class Bench {
+  public:
+    // Case of a given number of iterations, started and stopped through the timer
+    using Case = std::function<void(uint64_t iterations, Timer& timer)>;
+
+    Bench(int samples, double minTime, const std::string& filter);
+
+    // ops and items are per iteration, items being what an op processes (bodies, interactions, jobs).
+    // Nanoseconds per op, 0 when the filter skipped the case.
+    double run(const std::string& name, uint64_t ops, uint64_t items, const Case& body);
+
+    void save(const char* path) const;
+
+    // Non zero if a case got slower than the tolerance (in percent)
+    int compare(const char* path, double tolerance) const;
+
+  private:
+    struct Result {
+      std::string name;
+      double nsPerOp;
+      double itemsPerSecond;
+      double spread; // (max - min) / median of the samples
+    };
+
+    int samples;
+    double minTime;
+    std::string filter;
+    std::vector<Result> results;
+};
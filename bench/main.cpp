@@ -0,0 +1,356 @@
+// Microbenchmarks of the tree and kernel primitives
+//
+// Bench [--n 1000,100000] [--dist spiral,uniform,clustered] [--leaf 4,10,32] [--filter text]
+//       [--samples 5] [--min-time 0.1] [--save file] [--compare file] [--tolerance 10]
+//
+// The opening cases also print the force error of every criterion against a direct sum, and the time each
+// criterion takes at the error of each geometric theta.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+
+#include "Bench.hpp"
+#include "engine/Spawner.hpp"
+#include "engine/quadtree.hpp"
+
+#define BENCH_SEED 20240501
+#define BENCH_SUBDIVIDE_NODES 1024 // Nodes split per iteration of the subdivide case
+#define BENCH_ATTRACT_TARGETS 256
+#define BENCH_ATTRACT_SOURCES 1024
+#define BENCH_JOBS 4096
+#define BENCH_ERROR_SAMPLES 1024 // Bodies whose tree force is compared to the direct sum
+
+static volatile uint64_t sink; // Keeps results the compiler could otherwise drop
+
+template<uint32_t Limit>
+using LeafTuning = qt::Tuning<Limit, QUAD_TREE_THETA, ZERO_DIVISION_PREVENT_VALUE>;
+
+template<float Theta, qt::Opening Criterion>
+using OpeningTuning = qt::Tuning<QUAD_TREE_CONTAINER_LIMIT, Theta, ZERO_DIVISION_PREVENT_VALUE, Criterion>;
+
+// Error and speed of one opening criterion and parameter
+struct OpeningRun {
+  const char* criterion;
+  float parameter;
+  double error; // Mean relative force error of the sampled bodies
+  double ns;    // Per body walk
+};
+
+static std::vector<std::string> split(const char* list) {
+  std::vector<std::string> out;
+  std::stringstream ss(list);
+  for (std::string item; std::getline(ss, item, ',');) out.push_back(item);
+  return out;
+}
+
+static std::vector<Particle> generate(const std::string& distribution, uint32_t n) {
+  std::vector<Particle> bodies;
+  bodies.reserve(n);
+  std::mt19937 rng(BENCH_SEED);
+
+  if (distribution == "spiral") {
+    Spawner::spiral(bodies, {WIDTH * 0.5f, HEIGHT * 0.5f}, n);
+
+  } else if (distribution == "uniform") {
+    std::uniform_real_distribution<float> x(0.f, WIDTH), y(0.f, HEIGHT);
+    for (uint32_t i = 0; i < n; i++) bodies.push_back(Particle({x(rng), y(rng)}));
+
+  } else if (distribution == "clustered") {
+    // A few dense blobs on a sparse uniform background
+    std::uniform_real_distribution<float> x(0.f, WIDTH), y(0.f, HEIGHT);
+    std::normal_distribution<float> blob(0.f, 15.f);
+    nb::Vector2f centers[8];
+    for (nb::Vector2f& c : centers) c = {x(rng), y(rng)};
+
+    for (uint32_t i = 0; i < n; i++)
+      if (i % 10 == 0) bodies.push_back(Particle({x(rng), y(rng)}));
+      else bodies.push_back(Particle(centers[i % 8] + nb::Vector2f{blob(rng), blob(rng)}));
+  }
+
+  return bodies;
+}
+
+static nb::FloatRect bounds(const std::vector<Particle>& bodies) {
+  nb::Vector2f min = bodies.front().getPosition(), max = min;
+  for (const Particle& p : bodies) {
+    min = {std::min(min.x, p.getPosition().x), std::min(min.y, p.getPosition().y)};
+    max = {std::max(max.x, p.getPosition().x), std::max(max.y, p.getPosition().y)};
+  }
+
+  return {min.x, min.y, max.x - min.x, max.y - min.y};
+}
+
+// Square around every body, so none is left out of the tree whatever the distribution
+static qt::Rectangle fit(const std::vector<Particle>& bodies) {
+  nb::FloatRect b = bounds(bodies);
+  float half = std::max(b.width, b.height) * 0.5f + 1.f;
+  return {b.left + b.width * 0.5f, b.top + b.height * 0.5f, half, half};
+}
+
+static void containsCase(Bench& bench, const std::string& tag, const std::vector<Particle>& bodies) {
+  // Central part of the bodies, so the comparisons go both ways
+  nb::FloatRect b = bounds(bodies);
+  qt::Rectangle box(b.left + b.width * 0.5f, b.top + b.height * 0.5f, b.width * 0.25f, b.height * 0.25f);
+
+  bench.run("contains/" + tag, bodies.size(), bodies.size(), [&](uint64_t iterations, Timer& timer) {
+    uint64_t inside = 0;
+    timer.start();
+    for (uint64_t i = 0; i < iterations; i++)
+      for (const Particle& p : bodies)
+        inside += box.contains(&p);
+    timer.stop();
+    sink = inside;
+  });
+}
+
+template<uint32_t Limit>
+static void treeCases(Bench& bench, const std::string& tag, const std::vector<Particle>& bodies) {
+  using T = LeafTuning<Limit>;
+  const qt::Rectangle box = fit(bodies);
+  const std::string name = tag + "/leaf=" + std::to_string(Limit);
+
+  // Structure only, like the tree build before its moment pass
+  bench.run("insert/" + name, bodies.size(), bodies.size(), [&](uint64_t iterations, Timer& timer) {
+    for (uint64_t i = 0; i < iterations; i++) {
+      qt::Node* root = new qt::Node(box);
+      timer.start();
+      for (const Particle& p : bodies) root->insert<T>(&p);
+      timer.stop();
+      delete root;
+    }
+  });
+
+  // Nodes filled up to the limit, then the insert that splits each one
+  const uint32_t nodes = std::min<uint32_t>(BENCH_SUBDIVIDE_NODES, bodies.size() / (Limit + 1));
+  if (nodes)
+    bench.run("subdivide/" + name, nodes, nodes * (Limit + 1), [&](uint64_t iterations, Timer& timer) {
+      std::vector<qt::Node*> leaves(nodes);
+      for (uint64_t i = 0; i < iterations; i++) {
+        for (uint32_t j = 0; j < nodes; j++) {
+          leaves[j] = new qt::Node(box);
+          for (uint32_t k = 0; k < Limit; k++) leaves[j]->insert<T>(&bodies[j * (Limit + 1) + k]);
+        }
+
+        timer.start();
+        for (uint32_t j = 0; j < nodes; j++) leaves[j]->insert<T>(&bodies[j * (Limit + 1) + Limit]);
+        timer.stop();
+
+        for (qt::Node* leaf : leaves) delete leaf;
+      }
+    });
+
+  // One full walk per body, on copies so the accelerations can pile up
+  qt::Node* root = new qt::Node(box);
+  for (const Particle& p : bodies) root->insert<T>(&p);
+  root->refit();
+  std::vector<Particle> probes = bodies;
+
+  bench.run("solveAttraction/" + name, probes.size(), probes.size(), [&](uint64_t iterations, Timer& timer) {
+    timer.start();
+    for (uint64_t i = 0; i < iterations; i++)
+      for (Particle& p : probes) root->solveAttraction<T>(&p);
+    timer.stop();
+  });
+
+  delete root;
+}
+
+template<float Theta, qt::Opening Criterion>
+static void openingCase(Bench& bench, const std::string& tag, const std::vector<Particle>& bodies,
+                        const std::vector<nb::Vector2f>& exact, std::vector<OpeningRun>& out) {
+  using T = OpeningTuning<Theta, Criterion>;
+  const char* criterion = Criterion == qt::Opening::Bmax ? "bmax" : Criterion == qt::Opening::Acceleration ? "acceleration" : "theta";
+  const size_t stride = std::max<size_t>(bodies.size() / BENCH_ERROR_SAMPLES, 1);
+
+  qt::Node* root = new qt::Node(fit(bodies));
+  for (const Particle& p : bodies) root->insert<T>(&p);
+  root->refit();
+
+  double error = 0.0;
+  for (size_t i = 0, k = 0; i < bodies.size(); i += stride, k++) {
+    Particle probe = bodies[i];
+    root->solveAttraction<T>(&probe);
+    nb::Vector2f d = probe.getAcceleration() - exact[k];
+    error += std::sqrt(d.x * d.x + d.y * d.y) / std::max(std::sqrt(exact[k].x * exact[k].x + exact[k].y * exact[k].y), 1e-20f);
+  }
+  error /= exact.size();
+
+  std::vector<Particle> probes = bodies;
+  char name[64];
+  snprintf(name, sizeof(name), "opening/%s/%s=%g", tag.c_str(), criterion, Theta);
+  double ns = bench.run(name, probes.size(), probes.size(), [&](uint64_t iterations, Timer& timer) {
+    timer.start();
+    for (uint64_t i = 0; i < iterations; i++)
+      for (Particle& p : probes) root->solveAttraction<T>(&p);
+    timer.stop();
+  });
+
+  if (ns > 0.0) out.push_back({criterion, Theta, error, ns});
+  delete root;
+}
+
+// Time of a criterion at the given error, interpolated between its parameters on log scales
+static double timeAtError(const std::vector<OpeningRun>& runs, const char* criterion, double error) {
+  std::vector<const OpeningRun*> own;
+  for (const OpeningRun& r : runs)
+    if (strcmp(r.criterion, criterion) == 0) own.push_back(&r);
+  std::sort(own.begin(), own.end(), [](const OpeningRun* a, const OpeningRun* b) { return a->error < b->error; });
+
+  for (size_t i = 0; i + 1 < own.size(); i++) {
+    const OpeningRun& a = *own[i];
+    const OpeningRun& b = *own[i + 1];
+    if (error < a.error || error > b.error || a.error <= 0.0) continue;
+
+    double t = std::log(error / a.error) / std::log(b.error / a.error);
+    return std::exp(std::log(a.ns) + t * std::log(b.ns / a.ns));
+  }
+
+  return 0.0; // Out of the range its parameters cover
+}
+
+static void openingCases(Bench& bench, const std::string& tag, const std::vector<Particle>& source) {
+  // Direct forces of the sampled bodies, and one step of accelerations for the relative criterion
+  std::vector<Particle> bodies = source;
+  const size_t stride = std::max<size_t>(bodies.size() / BENCH_ERROR_SAMPLES, 1);
+  std::vector<nb::Vector2f> exact;
+  for (size_t i = 0; i < bodies.size(); i += stride) {
+    Particle probe = bodies[i];
+    for (size_t j = 0; j < bodies.size(); j++)
+      if (j != i) probe.attractTo(bodies[j].getPosition(), bodies[j].getMass());
+    exact.push_back(probe.getAcceleration());
+  }
+
+  qt::Node* root = new qt::Node(fit(bodies));
+  for (const Particle& p : bodies) root->insert(&p);
+  root->refit();
+  for (Particle& p : bodies) {
+    root->solveAttraction(&p);
+    p.update(0.f);
+  }
+  delete root;
+
+  // Past the grid of the variants table for the other criteria, so their errors reach those of the loosest theta
+  std::vector<OpeningRun> runs;
+  openingCase<0.3f, qt::Opening::Geometric>(bench, tag, bodies, exact, runs);
+  openingCase<0.5f, qt::Opening::Geometric>(bench, tag, bodies, exact, runs);
+  openingCase<0.8f, qt::Opening::Geometric>(bench, tag, bodies, exact, runs);
+  openingCase<0.3f, qt::Opening::Bmax>(bench, tag, bodies, exact, runs);
+  openingCase<0.5f, qt::Opening::Bmax>(bench, tag, bodies, exact, runs);
+  openingCase<0.8f, qt::Opening::Bmax>(bench, tag, bodies, exact, runs);
+  openingCase<1.2f, qt::Opening::Bmax>(bench, tag, bodies, exact, runs);
+  openingCase<0.001f, qt::Opening::Acceleration>(bench, tag, bodies, exact, runs);
+  openingCase<0.005f, qt::Opening::Acceleration>(bench, tag, bodies, exact, runs);
+  openingCase<0.02f, qt::Opening::Acceleration>(bench, tag, bodies, exact, runs);
+  openingCase<0.08f, qt::Opening::Acceleration>(bench, tag, bodies, exact, runs);
+
+  for (const OpeningRun& r : runs)
+    printf("  %-12s %-6g error %.2e, %.1f ns/body\n", r.criterion, r.parameter, r.error, r.ns);
+
+  for (const OpeningRun& r : runs) {
+    if (strcmp(r.criterion, "theta") != 0) continue;
+
+    printf("  at the error of theta %g (%.2e): theta %.1f", r.parameter, r.error, r.ns);
+    for (const char* criterion : {"bmax", "acceleration"}) {
+      double ns = timeAtError(runs, criterion, r.error);
+      if (ns > 0.0) printf(", %s %.1f", criterion, ns);
+      else printf(", %s out of range", criterion);
+    }
+    printf(" ns/body\n");
+  }
+}
+
+static void attractCase(Bench& bench) {
+  std::vector<Particle> bodies = generate("uniform", BENCH_ATTRACT_TARGETS + BENCH_ATTRACT_SOURCES);
+  const uint64_t pairs = BENCH_ATTRACT_TARGETS * BENCH_ATTRACT_SOURCES;
+
+  bench.run("attractTo", pairs, pairs, [&](uint64_t iterations, Timer& timer) {
+    timer.start();
+    for (uint64_t i = 0; i < iterations; i++)
+      for (uint32_t t = 0; t < BENCH_ATTRACT_TARGETS; t++)
+        for (uint32_t s = BENCH_ATTRACT_TARGETS; s < bodies.size(); s++)
+          bodies[t].attractTo(bodies[s].getPosition(), bodies[s].getMass());
+    timer.stop();
+  });
+}
+
+static void queueJobCase(Bench& bench) {
+  ThreadPool tp;
+  tp.start();
+  std::atomic<uint64_t> done = 0;
+
+  bench.run("queueJob/threads=" + std::to_string(tp.size()), BENCH_JOBS, BENCH_JOBS, [&](uint64_t iterations, Timer& timer) {
+    timer.start();
+    for (uint64_t i = 0; i < iterations; i++) {
+      for (uint32_t j = 0; j < BENCH_JOBS; j++)
+        tp.queueJob([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+      tp.waitForCompletion();
+    }
+    timer.stop();
+  });
+
+  tp.stop();
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<std::string> sizes{"1000", "100000"};
+  std::vector<std::string> distributions{"spiral", "uniform", "clustered"};
+  std::vector<std::string> leaves{"4", "10", "32"};
+  std::string filter;
+  int samples = 5;
+  double minTime = 0.1;
+  double tolerance = 10.0;
+  const char* savePath = nullptr;
+  const char* comparePath = nullptr;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--n") == 0) sizes = split(argv[i + 1]);
+    else if (strcmp(argv[i], "--dist") == 0) distributions = split(argv[i + 1]);
+    else if (strcmp(argv[i], "--leaf") == 0) leaves = split(argv[i + 1]);
+    else if (strcmp(argv[i], "--filter") == 0) filter = argv[i + 1];
+    else if (strcmp(argv[i], "--samples") == 0) samples = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--min-time") == 0) minTime = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--tolerance") == 0) tolerance = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--save") == 0) savePath = argv[i + 1];
+    else if (strcmp(argv[i], "--compare") == 0) comparePath = argv[i + 1];
+    else {
+      printf("Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+
+  Bench bench(samples, minTime, filter);
+
+  for (const std::string& distribution : distributions)
+    for (const std::string& size : sizes) {
+      std::vector<Particle> bodies = generate(distribution, atoi(size.c_str()));
+      if (bodies.empty()) {
+        printf("Unknown distribution %s\n", distribution.c_str());
+        return 1;
+      }
+
+      const std::string tag = distribution + "/n=" + size;
+      containsCase(bench, tag, bodies);
+
+      // Leaf capacities are template parameters, the same ones the variants table has
+      for (const std::string& leaf : leaves)
+        switch (atoi(leaf.c_str())) {
+          case 4:  treeCases<4>(bench, tag, bodies);  break;
+          case 10: treeCases<10>(bench, tag, bodies); break;
+          case 32: treeCases<32>(bench, tag, bodies); break;
+          default: printf("Leaf capacity %s is not compiled in (4, 10, 32)\n", leaf.c_str());
+        }
+
+      openingCases(bench, tag, bodies);
+    }
+
+  attractCase(bench);
+  queueJobCase(bench);
+
+  if (savePath) bench.save(savePath);
+  return comparePath ? bench.compare(comparePath, tolerance) : 0;
+}
@@ -1,4 +1,8 @@
+#include "SFML/OpenGL.hpp"
+
 #include "App.hpp"
+#include "colormaps.hpp"
+#include "engine/Spawner.hpp"
 
 App::App() {
   // Window
@@ -8,36 +12,45 @@ App::App() {
   // Font for some test text
   genericFont.loadFromFile("res/fonts/Minecraft rus.ttf");
 
-  // FPS text
-  fpsText.setString("99");
-  fpsText.setFont(genericFont);
-  fpsText.setCharacterSize(20);
-  fpsText.setOutlineColor(sf::Color(31, 31, 31));
-  fpsText.setOutlineThickness(3.f);
-  fpsText.setPosition({WIDTH - fpsText.getLocalBounds().width, 0});
+  overlay.setFont(genericFont);
 
   // Main canvas
   backgroundTexture.create(WIDTH, HEIGHT);
   backgroundSprite.setTexture(backgroundTexture.getTexture());
 
+  // Canvas of the density render mode, filled from DensityMap one byte per pixel
+  densityTexture.create(WIDTH, HEIGHT);
+  densitySprite.setTexture(densityTexture);
+
   // Load circle texture
   circleTexture.loadFromFile("res/img/circle.png");
   circleTexture.generateMipmap();
   circleTexture.setSmooth(true);
 
   shader.loadFromFile("res/shaders/intencity.frag", sf::Shader::Fragment);
-  shader.setUniform("texture", backgroundTexture.getTexture());
+  shader.setUniform("texture", sf::Shader::CurrentTexture);
   shader.setUniformArray("colormap", colormaps::inferno, 256);
 
-  particles = new ParticleSystem(&circleTexture);
+  particles = new ParticleSystem();
+  view.setSystem(particles);
+  particles->setAutotune(autotuning);
+  if (METRICS) metrics::serve(METRICS_ADDRESS);
+
+  TRACE_THREAD("main");
 }
 
 App::~App() {
+  metrics::stop();
   if (particles) delete particles;
 }
 
 void App::run() {
   while (window.isOpen()) {
+#if TRACING
+    trace::frame();
+#endif
+    TRACE_SCOPE("frame");
+
     sf::Event event;
     while (window.pollEvent(event)) {
       if (event.type == sf::Event::Closed)
@@ -51,49 +64,172 @@ void App::run() {
           case sf::Keyboard::Key::G:
             showGrid = !showGrid;
             break;
-          case sf::Keyboard::Key::R:
-            delete particles; particles = new ParticleSystem(&circleTexture);
+          case sf::Keyboard::Key::R: {
+            size_t variant = &particles->getVariant() - Variants::table;
+            delete particles; particles = new ParticleSystem();
+            view.setSystem(particles);
+            particles->setVariant(variant);
+            particles->setDiagnosticsInterval(showDiagnostics ? DIAGNOSTICS_INTERVAL : 0);
+            if (culling) particles->toggleCulling();
+            if (cachingInteractions) particles->toggleInteractionCache();
+            if (reordering != HILBERT_REORDER) particles->toggleReordering();
+            particles->setAutotune(autotuning);
             break;
+          }
           case sf::Keyboard::Key::F:
-            showFPS = !showFPS;
+            showOverlay = !showOverlay;
             break;
           case sf::Keyboard::Key::A:
+            autotuning = false;
+            particles->setAutotune(false);
             particles->toggleGpuMode();
             break;
+          case sf::Keyboard::Key::U:
+            autotuning = !autotuning;
+            particles->setAutotune(autotuning);
+            break;
+          case sf::Keyboard::Key::V: {
+            particles->nextVariant();
+            const Variant& v = particles->getVariant();
+            printf("Variant: limit %u, %s %g, softening %g\n", v.containerLimit, Variants::name(v.opening), v.theta, v.softening);
+            break;
+          }
+          case sf::Keyboard::Key::M:
+            particles->toggleMerging();
+            break;
+          case sf::Keyboard::Key::E:
+            showDiagnostics = !showDiagnostics;
+            particles->setDiagnosticsInterval(showDiagnostics ? DIAGNOSTICS_INTERVAL : 0);
+            break;
+          case sf::Keyboard::Key::D:
+            densityMode = !densityMode;
+            break;
+          case sf::Keyboard::Key::L:
+            culling = !culling;
+            particles->toggleCulling();
+            break;
+          case sf::Keyboard::Key::I:
+            autotuning = false;
+            particles->setAutotune(false);
+            particles->toggleInteractionCache();
+            cachingInteractions = particles->getEngine() == Engine::CachedTree;
+            break;
+          case sf::Keyboard::Key::H:
+            reordering = !reordering;
+            particles->toggleReordering();
+            break;
+          case sf::Keyboard::Key::X:
+            removingEscaped = !removingEscaped;
+            break;
+          case sf::Keyboard::Key::C:
+            camera.reset({0.f, 0.f, WIDTH, HEIGHT});
+            break;
           case sf::Keyboard::Key::P:
             qt::Node::printMaxReachedDepth();
             break;
+#if TRACING
+          case sf::Keyboard::Key::T:
+            if (!trace::isRecording()) trace::record(TRACE_FRAMES);
+            break;
+#endif
           default:
             break;
         }
 
-      if (event.type == sf::Event::MouseMoved)
-        mousePos = sf::Vector2f{sf::Mouse::getPosition(window)};
+      if (event.type == sf::Event::MouseMoved) {
+        sf::Vector2f pos{sf::Mouse::getPosition(window)};
+
+        // Right button drags the camera
+        if (dragging) {
+          float scale = camera.getSize().x / WIDTH;
+          camera.move((mousePos - pos) * scale);
+        }
+        mousePos = pos;
+      }
+
+      if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Right)
+        dragging = true;
+
+      if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Right)
+        dragging = false;
+
+      if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left)
+        spawning = true;
+
+      if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left)
+        spawning = false;
+
+      // Zoom keeps the point under the cursor in place
+      if (event.type == sf::Event::MouseWheelScrolled) {
+        sf::Vector2i pixel{event.mouseWheelScroll.x, event.mouseWheelScroll.y};
+        sf::Vector2f before = window.mapPixelToCoords(pixel, camera);
+        camera.zoom(event.mouseWheelScroll.delta > 0 ? 1.f / CAMERA_ZOOM_STEP : CAMERA_ZOOM_STEP);
+        camera.move(before - window.mapPixelToCoords(pixel, camera));
+      }
     }
 
+    const sf::Vector2f& size = camera.getSize();
+    const sf::Vector2f& center = camera.getCenter();
+    particles->setCamera({center.x - size.x * 0.5f, center.y - size.y * 0.5f, size.x, size.y}, size.x / WIDTH);
+
+    edit();
+
     dt = clock.restart().asSeconds();
     particles->update(dt);
 
+    backgroundTexture.setView(camera);
     backgroundTexture.clear();
     backgroundTexture.display();
 
     window.clear();
     draw();
+
+    TRACE_SCOPE("display");
     window.display();
   }
 }
 
-void App::draw() {
-  backgroundTexture.draw(*particles);
-  window.draw(backgroundSprite, &shader);
+void App::edit() {
+  if (spawning) {
+    // Drawn with the mouse, the cloud lands where the cursor is in the world
+    cloud.clear();
+    sf::Vector2f pos = window.mapPixelToCoords(sf::Vector2i(mousePos), camera);
+    Spawner::cloud(cloud, {pos.x, pos.y}, SPAWN_CLOUD_RADIUS, SPAWN_CLOUD_BODIES);
+    particles->addParticles(cloud);
+  }
+
+  if (removingEscaped) particles->removeEscaped(ESCAPE_DISTANCE);
+}
 
-  if (showGrid)
-    particles->drawGrid(window, 7);
+void App::draw() {
+  TRACE_SCOPE("draw");
+  sf::Clock drawClock;
+
+  if (densityMode) {
+    particles->accumulateDensity(densityMap);
+    uploadDensity();
+    window.draw(densitySprite, &shader);
+  } else {
+    backgroundTexture.draw(view);
+    window.draw(backgroundSprite, &shader);
+  }
 
-  if (showFPS) {
-    int fps = static_cast<int>(1.f / dt);
-    fpsText.setString(std::to_string(fps));
-    window.draw(fpsText);
+  if (showGrid) {
+    window.setView(camera);
+    view.drawGrid(window, 7);
+    window.setView(window.getDefaultView());
   }
+
+  // Only the submission is timed, what the GPU does shows in the frame time
+  overlay.record(*particles, dt, drawClock.getElapsedTime().asSeconds());
+  if (showOverlay) window.draw(overlay);
 }
 
+void App::uploadDensity() {
+  // Single channel upload, GL expands luminance to r = g = b which is what the colormap shader sums
+  sf::Texture::bind(&densityTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, densityMap.getWidth(), densityMap.getHeight(), GL_LUMINANCE, GL_UNSIGNED_BYTE, densityMap.getPixels());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  sf::Texture::bind(nullptr);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
-#include "engine/ParticleSystem.hpp"
+#include "PerfOverlay.hpp"
+#include "ParticleView.hpp"
 
 class App {
   public:
@@ -13,20 +14,38 @@ class App {
     sf::RenderWindow window;
     sf::Font genericFont;
     sf::Clock clock;
-    sf::Text fpsText;
+    PerfOverlay overlay;
     sf::Vector2f mousePos;
+    sf::View camera{sf::FloatRect(0.f, 0.f, WIDTH, HEIGHT)};
+    bool dragging = false;
+    bool spawning = false;             // Left button held, a cloud is added every frame
+    std::vector<Particle> cloud;
 
     sf::RenderTexture backgroundTexture;
     sf::Sprite backgroundSprite;
     sf::Texture circleTexture;
+    ParticleView view{&circleTexture};
     sf::Shader shader;
 
+    sf::Texture densityTexture;
+    sf::Sprite densitySprite;
+    DensityMap densityMap{WIDTH, HEIGHT};
+
     ParticleSystem* particles = nullptr;
     float dt;
     bool showGrid = false;
-    bool showFPS = true;
+    bool showOverlay = true;
+    bool showDiagnostics = false;
+    bool densityMode = false;
+    bool culling = false;
+    bool cachingInteractions = false;
+    bool autotuning = AUTOTUNE;
+    bool reordering = HILBERT_REORDER;
+    bool removingEscaped = false;
 
   private:
+    void edit();
     void draw();
+    void uploadDensity();
 };
 
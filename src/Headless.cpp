@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Headless.hpp"
+#include "engine/Ensemble.hpp"
+#include "engine/OutOfCore.hpp"
+#include "engine/ParticleSystem.hpp"
+#include "engine/Spawner.hpp"
+#include "engine/distributed/UnixSocketTransport.hpp"
+
+#ifdef __unix__
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define HEADLESS_DT (1.f / 60.f)
+
+// Seconds per step measured on rank 0, negative if the ranks couldn't be started or one was lost
+static float runRanks(int ranks, uint32_t particles, uint32_t steps) {
+  UnixSocketTransport* transport = UnixSocketTransport::fork(ranks);
+  if (!transport) return -1.f;
+
+  const bool root = transport->rank() == 0;
+  const uint32_t threads = std::max(1u, std::thread::hardware_concurrency() / ranks);
+
+  ParticleSystem* system = new ParticleSystem(particles, threads);
+  Domain* domain = new Domain(transport);
+  system->distribute(domain);
+  system->update(HEADLESS_DT); // The first decomposition moves most of the bodies
+
+  nb::Clock clock;
+  for (uint32_t i = 0; i < steps && !domain->hasFailed(); i++)
+    system->update(HEADLESS_DT);
+  float stepTime = clock.getElapsedTime().asSeconds() / steps;
+
+  const bool failed = domain->hasFailed();
+  delete system;
+
+  if (!root) std::_Exit(failed ? 1 : 0);
+  UnixSocketTransport::waitForRanks();
+
+  if (failed) {
+    printf("The run on %d ranks lost a rank\n", ranks);
+    return -1.f;
+  }
+  return stepTime;
+}
+
+// Member i of a sweep, the same spiral with the next variant of the table
+static void addMember(Ensemble& ensemble, uint32_t i, uint32_t particles) {
+  ensemble.add(particles).setVariant(i);
+}
+
+// Wall seconds of one process per member, each stepping its system on a pool of its own. Negative without fork.
+static float runProcesses(uint32_t members, uint32_t particles, uint32_t steps) {
+#ifdef __unix__
+  fflush(stdout);
+  nb::Clock clock;
+
+  for (uint32_t i = 0; i < members; i++) {
+    pid_t pid = fork();
+    if (pid < 0) return -1.f;
+    if (pid > 0) continue;
+
+    Ensemble* own = new Ensemble();
+    addMember(*own, i, particles);
+    for (uint32_t s = 0; s < steps; s++)
+      own->step(HEADLESS_DT);
+    delete own;
+    std::_Exit(0);
+  }
+
+  while (wait(nullptr) > 0);
+  return clock.getElapsedTime().asSeconds();
+#else
+  printf("Separate processes are not available on this platform\n");
+  return -1.f;
+#endif
+}
+
+int Headless::scaling(int maxRanks, uint32_t particles, uint32_t steps) {
+  float strongBase = 0.f;
+  float weakBase = 0.f;
+
+  printf("%-6s %-6s %10s %12s %8s %10s\n", "mode", "ranks", "bodies", "ms/step", "speedup", "efficiency");
+
+  for (int ranks = 1; ranks <= maxRanks; ranks *= 2) {
+    float t = runRanks(ranks, particles, steps);
+    if (t < 0.f) return 1;
+    if (ranks == 1) strongBase = t;
+    printf("%-6s %-6d %10u %12.3f %8.2f %9.0f%%\n", "strong", ranks, particles, t * 1000.f, strongBase / t, strongBase / t / ranks * 100.f);
+  }
+
+  for (int ranks = 1; ranks <= maxRanks; ranks *= 2) {
+    float t = runRanks(ranks, particles * ranks, steps);
+    if (t < 0.f) return 1;
+    if (ranks == 1) weakBase = t;
+    printf("%-6s %-6d %10u %12.3f %8s %9.0f%%\n", "weak", ranks, particles * ranks, t * 1000.f, "-", weakBase / t * 100.f);
+  }
+
+  return 0;
+}
+
+int Headless::numa(uint32_t particles, uint32_t steps) {
+  for (bool pinned : {false, true}) {
+    ParticleSystem* system = new ParticleSystem(particles, 0, pinned);
+    system->update(HEADLESS_DT);
+
+    nb::Clock clock;
+    for (uint32_t i = 0; i < steps; i++)
+      system->update(HEADLESS_DT);
+    float stepTime = clock.getElapsedTime().asSeconds() / steps;
+
+    printf("%s: %.3f ms/step\n", pinned ? "pinned" : "floating", stepTime * 1000.f);
+    std::vector<double> bandwidth = system->measureBandwidth(20);
+    for (size_t node = 0; node < bandwidth.size(); node++)
+      printf("  node %zu: %.2f GB/s\n", node, bandwidth[node]);
+
+    delete system;
+  }
+
+  return 0;
+}
+
+int Headless::ensemble(uint32_t members, uint32_t particles, uint32_t steps) {
+  // Both runs are timed from the first allocation to the last step, as a sweep would be
+  nb::Clock clock;
+  Ensemble* shared = new Ensemble();
+  for (uint32_t i = 0; i < members; i++)
+    addMember(*shared, i, particles);
+  for (uint32_t s = 0; s < steps; s++)
+    shared->step(HEADLESS_DT);
+  float sharedSeconds = clock.getElapsedTime().asSeconds();
+
+  shared->writeSummaries(ENSEMBLE_FILE);
+  delete shared;
+
+  float processSeconds = runProcesses(members, particles, steps);
+  if (processSeconds < 0.f) return 1;
+
+  const double bodySteps = static_cast<double>(members) * particles * steps;
+  printf("%u members of %u bodies, %u steps\n", members, particles, steps);
+  printf("  shared pool: %8.3f s, %.3g body-steps/s\n", sharedSeconds, bodySteps / sharedSeconds);
+  printf("  processes:   %8.3f s, %.3g body-steps/s\n", processSeconds, bodySteps / processSeconds);
+  printf("  speedup %.2f, summaries in %s\n", processSeconds / sharedSeconds, ENSEMBLE_FILE);
+
+  return 0;
+}
+
+int Headless::serve(const char* address, uint32_t particles, uint32_t steps) {
+  if (!metrics::serve(address)) return 1;
+
+  ParticleSystem* system = new ParticleSystem(particles);
+  system->setAutotune(AUTOTUNE);
+  for (uint32_t i = 0; steps == 0 || i < steps; i++)
+    system->update(HEADLESS_DT);
+
+  delete system;
+  metrics::stop();
+  return 0;
+}
+
+int Headless::outOfCore(uint64_t particles, uint32_t steps, uint32_t budgetMB) {
+  // Before the in-memory run, whose pages would otherwise count towards the peak
+  const size_t baseline = OutOfCore::residentBytes();
+  OutOfCore* ooc = new OutOfCore(OOC_FILE, particles, static_cast<size_t>(budgetMB) << 20);
+  if (!ooc->isOpen()) {
+    delete ooc;
+    return 1;
+  }
+
+  printf("%llu bodies out of core: %u tiles of about %llu, budget %u MB\n", static_cast<unsigned long long>(ooc->size()),
+    ooc->getTileCount(), static_cast<unsigned long long>(ooc->getTileBodies()), budgetMB);
+
+  const double error = ooc->forceError(OOC_ERROR_SAMPLES);
+  nb::Clock clock;
+  for (uint32_t i = 0; i < steps; i++)
+    ooc->step(HEADLESS_DT);
+  const float oocSeconds = clock.getElapsedTime().asSeconds();
+
+  const float mb = 1.f / (1 << 20);
+  const float peak = ooc->getPeakRss() * mb, above = (ooc->getPeakRss() - std::min(baseline, ooc->getPeakRss())) * mb;
+  printf("  %.3g body steps/s, force error %.2e, at most %u tiles resident\n", ooc->size() * steps / oocSeconds, error,
+    ooc->getMostResident());
+  printf("  peak resident %.1f MB, %.1f MB over the %.1f MB before the run: %s the budget\n", peak, above, baseline * mb,
+    above <= budgetMB ? "within" : "over");
+
+  const uint64_t bodies = ooc->size();
+  delete ooc;
+
+  // The in-memory engine counts its bodies in 32 bits
+  if (bodies > UINT32_MAX) {
+    printf("In memory: skipped, at most %u bodies\n", UINT32_MAX);
+    return 0;
+  }
+
+  // It also holds everything: past what fits it is left out rather than run into the OOM killer
+  const uint64_t needed = bodies * OOC_MEMORY_BODY_BYTES;
+  const size_t available = OutOfCore::availableBytes();
+  if (needed > available) {
+    printf("In memory: skipped, about %.0f MB needed, %.0f MB available\n", needed * mb, available * mb);
+    return 0;
+  }
+
+  ParticleSystem* system = new ParticleSystem(static_cast<uint32_t>(bodies));
+  system->update(HEADLESS_DT); // Builds the first tree outside of the timing
+  clock.restart();
+  for (uint32_t i = 0; i < steps; i++)
+    system->update(HEADLESS_DT);
+  const float memorySeconds = clock.getElapsedTime().asSeconds();
+
+  printf("In memory: %.3g body steps/s, peak resident %.1f MB\n", bodies * steps / memorySeconds, OutOfCore::residentBytes() * mb);
+  delete system;
+  return 0;
+}
+
+int Headless::openclDevices(uint32_t particles, uint32_t steps, uint32_t subDeviceUnits) {
+  if (!RuntimeOpenCL::isAvailable(true)) {
+    printf("No OpenCL device\n");
+    return 1;
+  }
+  steps = std::max(steps, 1u);
+
+  std::vector<Particle> bodies, reference;
+  Spawner::spiral(bodies, {WIDTH * 0.5f, HEIGHT * 0.5f}, particles);
+  reference = bodies;
+
+  RuntimeOpenCL* gpu = new RuntimeOpenCL(bodies, true, subDeviceUnits);
+  gpu->run(HEADLESS_DT, ZERO_DIVISION_PREVENT_VALUE, bodies); // Measures the devices before the timing
+
+  nb::Clock clock;
+  for (uint32_t i = 0; i < steps; i++)
+    gpu->run(HEADLESS_DT, ZERO_DIVISION_PREVENT_VALUE, bodies);
+  const float seconds = clock.getElapsedTime().asSeconds();
+
+  printf("%u bodies on %zu devices: %.3g body steps/s\n", particles, gpu->getDeviceCount(),
+    bodies.size() * steps / std::max(seconds, 1e-6f));
+  for (size_t d = 0; d < gpu->getDeviceCount(); d++)
+    printf("  %s: %u bodies\n", gpu->getDeviceName(d).c_str(), gpu->getDeviceBodies(d));
+  delete gpu;
+
+  // Same force and integration on the CPU for as many steps, the measuring one included. Only the order of the sums differs.
+  const Variant& variant = Variants::table[Variants::defaultIndex()];
+  for (uint32_t i = 0; i <= steps; i++) {
+    variant.solveDirect(reference, reference.data(), reference.data() + reference.size());
+    for (Particle& p : reference) p.update(HEADLESS_DT);
+  }
+
+  double largest = 0.0;
+  for (size_t i = 0; i < bodies.size(); i++) {
+    nb::Vector2f d = bodies[i].getPosition() - reference[i].getPosition();
+    largest = std::max<double>(largest, std::sqrt(d.x * d.x + d.y * d.y));
+  }
+  printf("  farthest body from the CPU's direct sum: %.3g\n", largest);
+  return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+// Runs without a window, for measurements
+struct Headless {
+  // Strong (fixed N) and weak (N per rank) scaling of the domain decomposition, 1 to maxRanks forked ranks
+  static int scaling(int maxRanks, uint32_t particles, uint32_t steps);
+
+  // Step time and per node bandwidth with floating workers, then with pinned workers and first-touched memory
+  static int numa(uint32_t particles, uint32_t steps);
+
+  // Body steps per second of that many systems on one shared pool, then of as many processes with one system each
+  static int ensemble(uint32_t members, uint32_t particles, uint32_t steps);
+
+  // Steps one system and serves its metrics on the address (see metrics::serve), forever when steps is 0
+  static int serve(const char* address, uint32_t particles, uint32_t steps);
+
+  // Body steps per second and peak resident set of that many bodies kept in a file within the budget, then body steps
+  // per second of the in-memory engine on as many when they fit in the memory available
+  static int outOfCore(uint64_t particles, uint32_t steps, uint32_t budgetMB);
+
+  // Body steps per second of the OpenCL step split between every device, the devices split into sub-devices of that
+  // many compute units (0 keeps them whole), and how far its bodies are from the CPU's direct sum after the run
+  static int openclDevices(uint32_t particles, uint32_t steps, uint32_t subDeviceUnits);
+};
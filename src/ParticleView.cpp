@@ -0,0 +1,47 @@
+#include <cstddef>
+
+#include "ParticleView.hpp"
+
+static_assert(sizeof(nb::Vertex) == sizeof(sf::Vertex), "nb::Vertex no longer matches sf::Vertex");
+static_assert(offsetof(nb::Vertex, color) == offsetof(sf::Vertex, color), "nb::Vertex no longer matches sf::Vertex");
+static_assert(offsetof(nb::Vertex, texCoords) == offsetof(sf::Vertex, texCoords), "nb::Vertex no longer matches sf::Vertex");
+
+ParticleView::ParticleView(const sf::Texture* texture) : texture(texture) {}
+
+void ParticleView::setSystem(const ParticleSystem* s) {
+  system = s;
+}
+
+void ParticleView::drawGrid(sf::RenderTarget& target, uint32_t limit) {
+  static const sf::Color color(30, 30, 30);
+  if (!system) return;
+
+  gridRects.clear();
+  system->collectGrid(limit, gridRects);
+
+  // Top, right and bottom of every node, in one batch of lines rather than a draw per node
+  gridLines.clear();
+  for (const nb::FloatRect& r : gridRects) {
+    sf::Vector2f topLeft{r.left, r.top};
+    sf::Vector2f topRight{r.left + r.width, r.top};
+    sf::Vector2f bottomRight{r.left + r.width, r.top + r.height};
+    sf::Vector2f bottomLeft{r.left, r.top + r.height};
+    gridLines.insert(gridLines.end(), {
+      {topLeft, color}, {topRight, color},
+      {topRight, color}, {bottomRight, color},
+      {bottomRight, color}, {bottomLeft, color}
+    });
+  }
+
+  target.draw(gridLines.data(), gridLines.size(), sf::Lines);
+}
+
+void ParticleView::draw(sf::RenderTarget& target, sf::RenderStates states) const {
+  if (!system) return;
+
+  states.transform *= getTransform();
+  states.texture = texture;
+  states.blendMode = sf::BlendAdd;
+
+  target.draw(reinterpret_cast<const sf::Vertex*>(system->getVertices()), system->getVertexCount(), sf::Quads, states);
+}
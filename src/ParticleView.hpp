@@ -0,0 +1,24 @@
+#pragma once
+
+#include "engine/ParticleSystem.hpp"
+
+// Draws the quads of a system as they are, the engine's vertices share the layout of SFML's
+class ParticleView : public sf::Drawable, public sf::Transformable {
+  public:
+    explicit ParticleView(const sf::Texture* texture);
+
+    void setSystem(const ParticleSystem* system);
+
+    // The deeper the limit the more time to draw the grid
+    void drawGrid(sf::RenderTarget& target, uint32_t limit = QUAD_TREE_MAX_DEPTH);
+
+  private:
+    const sf::Texture* texture;
+    const ParticleSystem* system = nullptr;
+
+    std::vector<nb::FloatRect> gridRects;
+    std::vector<sf::Vertex> gridLines;
+
+  private:
+    virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const;
+};
@@ -0,0 +1,95 @@
+#include "PerfOverlay.hpp"
+
+static const char* phaseNames[] = {"frame", "tree", "force", "integrate", "vertices", "draw"};
+
+void PerfOverlay::Window::push(float seconds) {
+  samples[next] = seconds;
+  next = (next + 1) % PERF_OVERLAY_WINDOW;
+  count = std::min(count + 1, (uint32_t)PERF_OVERLAY_WINDOW);
+}
+
+void PerfOverlay::Window::percentiles(float& p50, float& p95, float& p99) const {
+  if (!count) {
+    p50 = p95 = p99 = 0.f;
+    return;
+  }
+
+  float sorted[PERF_OVERLAY_WINDOW];
+  std::copy(samples, samples + count, sorted);
+  std::sort(sorted, sorted + count);
+
+  p50 = sorted[count * 50 / 100];
+  p95 = sorted[count * 95 / 100];
+  p99 = sorted[count * 99 / 100];
+}
+
+void PerfOverlay::setFont(const sf::Font& font) {
+  text.setFont(font);
+  text.setCharacterSize(14);
+  text.setOutlineColor(sf::Color(31, 31, 31));
+  text.setOutlineThickness(2.f);
+}
+
+void PerfOverlay::record(const ParticleSystem& particles, float frameTime, float drawTime) {
+  const ParticleSystem::StepTimes& step = particles.getStepTimes();
+  phases[Frame].push(frameTime);
+  phases[Tree].push(step.tree);
+  phases[Force].push(step.force);
+  phases[Integrate].push(step.integrate);
+  phases[Vertices].push(step.vertices);
+  phases[Draw].push(drawTime);
+
+  if (refreshClock.getElapsedTime().asSeconds() >= PERF_OVERLAY_REFRESH) refresh(particles);
+}
+
+void PerfOverlay::refresh(const ParticleSystem& particles) {
+  const float elapsed = refreshClock.restart().asSeconds();
+  char buffer[1024];
+  int length = 0;
+
+  float p50, p95, p99;
+  phases[Frame].percentiles(p50, p95, p99);
+  length += snprintf(buffer + length, sizeof(buffer) - length, "%.0f fps, %zu bodies, %s\n", p50 > 0.f ? 1.f / p50 : 0.f, particles.getParticleCount(), particles.getEngineName());
+
+  const Variant& v = particles.getVariant();
+  length += snprintf(buffer + length, sizeof(buffer) - length, "limit %u, %s %g, softening %g\n", v.containerLimit, Variants::name(v.opening), v.theta, v.softening);
+
+  // Pick of the autotuner and the runner up
+  const Autotuner* tuner = particles.getAutotuner();
+  if (tuner && tuner->getCandidates().size() > 1) {
+    const std::vector<Autotuner::Candidate>& c = tuner->getCandidates();
+    length += snprintf(buffer + length, sizeof(buffer) - length, "autotuned (%s): %s %.2f ms, then %s %.2f ms\n",
+      tuner->wasCached() ? "cached" : "measured", c[0].name.c_str(), c[0].seconds * 1e3f, c[1].name.c_str(), c[1].seconds * 1e3f);
+  }
+  length += snprintf(buffer + length, sizeof(buffer) - length, "\n");
+
+  length += snprintf(buffer + length, sizeof(buffer) - length, "ms           p50     p95     p99\n");
+  for (int i = 0; i < PhaseCount; i++) {
+    phases[i].percentiles(p50, p95, p99);
+    length += snprintf(buffer + length, sizeof(buffer) - length, "%-10s %6.2f  %6.2f  %6.2f\n", phaseNames[i], p50 * 1e3f, p95 * 1e3f, p99 * 1e3f);
+  }
+
+  uint32_t nodes, depth;
+  particles.countTreeNodes(nodes, depth);
+  length += snprintf(buffer + length, sizeof(buffer) - length, "\n%.3g interactions per step\n", (double)particles.getInteractions());
+  length += snprintf(buffer + length, sizeof(buffer) - length, "tree %u nodes, depth %u, %zu far\n", nodes, depth, particles.getFarFieldCount());
+
+  const HilbertOrder* ordering = particles.getOrdering();
+  if (ordering && ordering->getInterval())
+    length += snprintf(buffer + length, sizeof(buffer) - length, "Hilbert sort every %u steps\n", ordering->getInterval());
+
+  // Share of the workers' time spent in jobs since the last refresh
+  const ThreadPool& tp = particles.getThreadPool();
+  uint64_t busy = tp.busyTime();
+  if (busy < lastBusy) lastBusy = 0; // The system was reset with a new pool
+  float utilization = (busy - lastBusy) * 1e-9f / (elapsed * tp.size());
+  lastBusy = busy;
+  snprintf(buffer + length, sizeof(buffer) - length, "%d threads, %.0f%% busy", tp.size(), std::min(utilization, 1.f) * 100.f);
+
+  text.setString(buffer);
+  text.setPosition({WIDTH - text.getLocalBounds().width - 10.f, 0.f});
+}
+
+void PerfOverlay::draw(sf::RenderTarget& target, sf::RenderStates states) const {
+  target.draw(text, states);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "engine/ParticleSystem.hpp"
+
+// Rolling p50/p95/p99 of the frame and its phases, with a few figures of the tree and the pool.
+// Samples are kept every frame, the text is only formatted again a few times per second.
+class PerfOverlay : public sf::Drawable {
+  public:
+    void setFont(const sf::Font& font);
+
+    // Once per frame, drawTime being what the scene took to submit on the CPU
+    void record(const ParticleSystem& particles, float frameTime, float drawTime);
+
+  private:
+    enum Phase { Frame, Tree, Force, Integrate, Vertices, Draw, PhaseCount };
+
+    // Last PERF_OVERLAY_WINDOW samples of one phase, in seconds
+    struct Window {
+      float samples[PERF_OVERLAY_WINDOW] = {};
+      uint32_t next = 0;
+      uint32_t count = 0;
+
+      void push(float seconds);
+      void percentiles(float& p50, float& p95, float& p99) const;
+    };
+
+    Window phases[PhaseCount];
+    sf::Text text;
+    sf::Clock refreshClock;
+    uint64_t lastBusy = 0; // Pool busy time at the last refresh
+
+  private:
+    void refresh(const ParticleSystem& particles);
+    virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const;
+};
@@ -0,0 +1,79 @@
+#include "nbody.h"
+#include "../engine/ParticleSystem.hpp"
+
+static_assert((int)NBODY_ENGINE_OPENCL == (int)Engine::OpenCL, "nbody_engine no longer matches Engine");
+static_assert((int)NBODY_OPENING_ACCELERATION == (int)qt::Opening::Acceleration, "nbody_opening no longer matches qt::Opening");
+
+struct nbody_system {
+  ParticleSystem system;
+  std::vector<Particle> added;
+
+  nbody_system(uint32_t bodies, uint32_t threads) : system(bodies, threads) {}
+};
+
+// Span over one member of every body, in place
+template<class T>
+static nbody_span span(const std::vector<Particle>& particles, const T& (Particle::*member)() const) {
+  if (particles.empty()) return {nullptr, 0, sizeof(Particle)};
+  return {reinterpret_cast<const float*>(&(particles.front().*member)()), particles.size(), sizeof(Particle)};
+}
+
+nbody_system* nbody_create(uint32_t bodies, uint32_t threads) {
+  return new nbody_system(bodies, threads);
+}
+
+void nbody_destroy(nbody_system* system) {
+  delete system;
+}
+
+void nbody_step(nbody_system* system, float dt) {
+  system->system.update(dt);
+}
+
+void nbody_add(nbody_system* system, const float* positions, const float* velocities, const float* masses, size_t count) {
+  system->added.clear();
+  for (size_t i = 0; i < count; i++) {
+    Particle p({positions[i * 2], positions[i * 2 + 1]}, masses[i]);
+    if (velocities) p.setVelocity({velocities[i * 2], velocities[i * 2 + 1]});
+    system->added.push_back(p);
+  }
+  system->system.addParticles(system->added);
+}
+
+size_t nbody_count(const nbody_system* system) {
+  return system->system.getParticleCount();
+}
+
+void nbody_set_engine(nbody_system* system, nbody_engine engine) {
+  system->system.setEngine(static_cast<Engine>(engine));
+}
+
+void nbody_set_autotune(nbody_system* system, int enabled) {
+  system->system.setAutotune(enabled);
+}
+
+int nbody_set_variant(nbody_system* system, uint32_t leafCapacity, float theta, float softening, nbody_opening opening) {
+  size_t index = Variants::find(leafCapacity, theta, softening, static_cast<qt::Opening>(opening));
+  const Variant& v = Variants::table[index];
+  if (v.containerLimit != leafCapacity || v.theta != theta || v.softening != softening || v.opening != static_cast<qt::Opening>(opening))
+    return 0;
+
+  system->system.setVariant(index);
+  return 1;
+}
+
+nbody_span nbody_positions(nbody_system* system) {
+  return span(system->system.getParticles(), &Particle::getPosition);
+}
+
+nbody_span nbody_velocities(nbody_system* system) {
+  return span(system->system.getParticles(), &Particle::getVelocity);
+}
+
+nbody_span nbody_masses(nbody_system* system) {
+  return span(system->system.getParticles(), &Particle::getMass);
+}
+
+nbody_span nbody_vertices(const nbody_system* system) {
+  return {reinterpret_cast<const float*>(system->system.getVertices()), system->system.getVertexCount(), sizeof(nb::Vertex)};
+}
@@ -0,0 +1,67 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* C interface of the simulation core, for embedding it without SFML or C++ on the caller's side.
+ * Bodies are read in place: a span points into the engine's own storage and stays valid until the next step or
+ * edit of that system. Bodies may change places between steps, as the engine sorts them for locality. Calls on one
+ * system must not overlap, the engine runs every step on its own threads. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct nbody_system nbody_system;
+
+/* Element i is at (const char*)data + i * stride, for positions and velocities x then y */
+typedef struct nbody_span {
+  const float* data;
+  size_t count;
+  size_t stride; /* Bytes */
+} nbody_span;
+
+typedef enum nbody_engine {
+  NBODY_ENGINE_TREE,
+  NBODY_ENGINE_CACHED_TREE,
+  NBODY_ENGINE_DIRECT,
+  NBODY_ENGINE_OPENCL
+} nbody_engine;
+
+typedef enum nbody_opening {
+  NBODY_OPENING_GEOMETRIC,
+  NBODY_OPENING_BMAX,
+  NBODY_OPENING_ACCELERATION
+} nbody_opening;
+
+/* Spiral galaxy of that many bodies. 0 threads uses every hardware thread. */
+nbody_system* nbody_create(uint32_t bodies, uint32_t threads);
+void nbody_destroy(nbody_system* system);
+
+void nbody_step(nbody_system* system, float dt);
+
+/* Appends count bodies, velocities may be null for bodies at rest */
+void nbody_add(nbody_system* system, const float* positions, const float* velocities, const float* masses, size_t count);
+size_t nbody_count(const nbody_system* system);
+
+void nbody_set_engine(nbody_system* system, nbody_engine engine);
+void nbody_set_autotune(nbody_system* system, int enabled);
+
+/* Tree parameters, only the combinations compiled into the engine exist: returns 0 and changes nothing otherwise */
+int nbody_set_variant(nbody_system* system, uint32_t leaf_capacity, float theta, float softening, nbody_opening opening);
+
+/* Of the last step. On the OpenCL engine the bodies are downloaded once first if the device is ahead. */
+nbody_span nbody_positions(nbody_system* system);
+nbody_span nbody_velocities(nbody_system* system);
+nbody_span nbody_masses(nbody_system* system);
+
+/* Corners of the quads of the last step, 4 per body or per aggregate while culling: position, RGBA8 color and
+ * texture coordinates in 20 bytes, ready for a vertex buffer */
+nbody_span nbody_vertices(const nbody_system* system);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,3 @@
+#pragma once
+#include "preferences.hpp"
+#include "utils/utils.hpp"
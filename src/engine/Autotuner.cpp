@@ -0,0 +1,194 @@
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+
+#include "Autotuner.hpp"
+#include "ParticleSystem.hpp"
+
+#define AUTOTUNE_GRID 32 // Cells per side of the clustering measure
+
+static const uint32_t leafCapacities[] = {4, 10, 32}; // The ones the variants table has
+
+const char* engineName(Engine engine) {
+  switch (engine) {
+    case Engine::Tree:       return "tree";
+    case Engine::CachedTree: return "lists";
+    case Engine::Direct:     return "direct";
+    case Engine::OpenCL:     return "opencl";
+  }
+  return "";
+}
+
+bool Autotuner::Workload::operator==(const Workload& other) const {
+  return size == other.size && clustering == other.clustering;
+}
+
+Autotuner::Workload Autotuner::classify(const std::vector<Particle>& particles) {
+  if (particles.empty()) return {0, 0};
+
+  nb::Vector2f min = particles.front().getPosition(), max = min;
+  for (const Particle& p : particles) {
+    min = {std::min(min.x, p.getPosition().x), std::min(min.y, p.getPosition().y)};
+    max = {std::max(max.x, p.getPosition().x), std::max(max.y, p.getPosition().y)};
+  }
+
+  // Share of a grid over the bounding box left empty, a few dense clumps leave most of it
+  std::vector<uint8_t> occupied(AUTOTUNE_GRID * AUTOTUNE_GRID, 0);
+  float sx = AUTOTUNE_GRID / std::max(max.x - min.x, 1e-6f);
+  float sy = AUTOTUNE_GRID / std::max(max.y - min.y, 1e-6f);
+  for (const Particle& p : particles) {
+    int x = std::min(static_cast<int>((p.getPosition().x - min.x) * sx), AUTOTUNE_GRID - 1);
+    int y = std::min(static_cast<int>((p.getPosition().y - min.y) * sy), AUTOTUNE_GRID - 1);
+    occupied[y * AUTOTUNE_GRID + x] = 1;
+  }
+
+  uint32_t filled = 0;
+  for (uint8_t o : occupied) filled += o;
+  float empty = 1.f - static_cast<float>(filled) / occupied.size();
+
+  return {static_cast<uint32_t>(std::log2(particles.size())), std::min(static_cast<uint32_t>(empty * 4.f), 3u)};
+}
+
+Autotuner::Autotuner() {
+  machine = std::to_string(std::thread::hardware_concurrency()) + "t-" + (RuntimeOpenCL::isAvailable() ? "opencl" : "cpu");
+
+  std::ifstream file(AUTOTUNE_FILE);
+  for (std::string line; std::getline(file, line);)
+    if (!line.empty()) cache.push_back(line);
+}
+
+bool Autotuner::isStale(const std::vector<Particle>& particles) {
+  // N only changes through merging and the clustering slowly, the bodies are not classified every step
+  if (particles.size() == checkedSize && ++checkSteps < AUTOTUNE_CHECK_INTERVAL) return false;
+
+  checkedSize = particles.size();
+  checkSteps = 0;
+  return !(classify(particles) == workload);
+}
+
+void Autotuner::tune(ParticleSystem& system) {
+  TRACE_SCOPE("autotune");
+  workload = classify(system.particles);
+  checkedSize = system.particles.size();
+
+  listCandidates(system);
+  cached = lookup();
+  if (!cached) {
+    measure(system);
+    save();
+  }
+
+  std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.seconds < b.seconds; });
+  const Candidate& best = candidates.front();
+  system.setVariant(best.variant);
+  system.setEngine(best.engine);
+
+  printf("Autotune N 2^%u, clustering %u/3 (%s):", workload.size, workload.clustering, cached ? "cached" : "measured");
+  for (const Candidate& c : candidates) printf(" %s %.2f ms", c.name.c_str(), c.seconds * 1000.f);
+  printf(", using %s\n", best.name.c_str());
+}
+
+const std::vector<Autotuner::Candidate>& Autotuner::getCandidates() const {
+  return candidates;
+}
+
+const Autotuner::Workload& Autotuner::getWorkload() const {
+  return workload;
+}
+
+bool Autotuner::wasCached() const {
+  return cached;
+}
+
+void Autotuner::listCandidates(const ParticleSystem& system) {
+  const Variant& current = system.getVariant();
+  const size_t currentIndex = &current - Variants::table;
+  candidates.clear();
+
+  // Leaf capacity only changes the speed, the opening criterion, theta and softening stay what the user picked
+  for (uint32_t limit : leafCapacities)
+    for (size_t i = 0; i < Variants::count; i++) {
+      const Variant& v = Variants::table[i];
+      if (v.containerLimit != limit || v.theta != current.theta || v.softening != current.softening || v.opening != current.opening) continue;
+
+      candidates.push_back({Engine::Tree, i, 0.f, "tree/" + std::to_string(limit)});
+      candidates.push_back({Engine::CachedTree, i, 0.f, "lists/" + std::to_string(limit)});
+      break;
+    }
+
+  // A single direct step past this many bodies takes longer than timing everything else
+  if (system.particles.size() <= AUTOTUNE_DIRECT_MAX_BODIES)
+    candidates.push_back({Engine::Direct, currentIndex, 0.f, "direct"});
+
+  if (machine.ends_with("opencl"))
+    candidates.push_back({Engine::OpenCL, currentIndex, 0.f, "opencl"});
+}
+
+bool Autotuner::lookup() {
+  const std::string prefix = machine + " " + std::to_string(workload.size) + " " + std::to_string(workload.clustering) + " ";
+
+  for (Candidate& c : candidates) {
+    const std::string key = prefix + c.name + " ";
+    auto line = std::find_if(cache.rbegin(), cache.rend(), [&key](const std::string& l) { return l.starts_with(key); });
+    if (line == cache.rend()) return false;
+
+    // A truncated or hand-edited line is a miss, the workload is timed again and a good line appended
+    const char* begin = line->c_str() + key.size();
+    char* end;
+    c.seconds = strtof(begin, &end);
+    if (end == begin || !(c.seconds >= 0.f) || std::isinf(c.seconds)) return false;
+    while (*end == ' ' || *end == '\r') end++;
+    if (*end) return false;
+  }
+
+  return true;
+}
+
+void Autotuner::measure(ParticleSystem& system) {
+  // Trial steps run on the real bodies, they are put back after every candidate
+  const std::vector<Particle> saved = system.particles;
+  const uint32_t savedSteps = system.steps;
+  float best = INFINITY;
+
+  for (Candidate& c : candidates) {
+    system.restore(saved);
+    system.setVariant(c.variant);
+    system.setEngine(c.engine);
+
+    std::vector<float> times;
+    for (int s = 0; s < AUTOTUNE_WARMUP_STEPS + AUTOTUNE_STEPS; s++) {
+      nb::Clock clock;
+      system.step(AUTOTUNE_DT);
+      float t = clock.getElapsedTime().asSeconds();
+
+      // Warm up steps build, upload and first touch. One far slower than the best so far settles it.
+      if (s < AUTOTUNE_WARMUP_STEPS) {
+        if (t > best * AUTOTUNE_CUTOFF) {
+          times.push_back(t);
+          break;
+        }
+        continue;
+      }
+      times.push_back(t);
+    }
+
+    std::sort(times.begin(), times.end());
+    c.seconds = times[times.size() / 2];
+    best = std::min(best, c.seconds);
+  }
+
+  system.restore(saved);
+  system.steps = savedSteps;
+}
+
+void Autotuner::save() {
+  const std::string prefix = machine + " " + std::to_string(workload.size) + " " + std::to_string(workload.clustering) + " ";
+
+  std::erase_if(cache, [&prefix](const std::string& line) { return line.starts_with(prefix); });
+  for (const Candidate& c : candidates)
+    cache.push_back(prefix + c.name + " " + std::to_string(c.seconds));
+
+  std::ofstream file(AUTOTUNE_FILE);
+  for (const std::string& line : cache)
+    file << line << '\n';
+}
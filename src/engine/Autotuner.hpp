@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Particle.hpp"
+
+class ParticleSystem;
+
+enum class Engine { Tree, CachedTree, Direct, OpenCL };
+
+// Times every engine, and every leaf capacity of the tree engines, on the current bodies and picks the fastest.
+// Results are kept on disk per machine and workload (N and clustering buckets), so a workload is only timed once.
+class Autotuner {
+  public:
+    struct Candidate {
+      Engine engine;
+      size_t variant;    // Index in Variants::table, the theta and softening in use with another leaf capacity
+      float seconds;     // Per step, median of the timed steps
+      std::string name;  // Key in the cache
+    };
+
+    // Bodies bucketed by N (powers of two) and by how much of their bounding box they leave empty
+    struct Workload {
+      uint32_t size;
+      uint32_t clustering;
+
+      bool operator==(const Workload& other) const;
+    };
+
+    static Workload classify(const std::vector<Particle>& particles);
+
+    Autotuner();
+
+    // Whether the bodies moved to another workload since the last tune
+    [[nodiscard]] bool isStale(const std::vector<Particle>& particles);
+
+    // Candidates from the cache, or timed on the bodies (which are put back afterwards), then the fastest is applied
+    void tune(ParticleSystem& system);
+
+    [[nodiscard]] const std::vector<Candidate>& getCandidates() const; // Fastest first
+    [[nodiscard]] const Workload& getWorkload() const;
+    [[nodiscard]] bool wasCached() const;
+
+  private:
+    std::string machine; // Threads and GPU, entries of other setups are ignored
+    std::vector<std::string> cache; // Lines of the cache file
+    std::vector<Candidate> candidates;
+    Workload workload{~0u, ~0u};
+    size_t checkedSize = 0;
+    uint32_t checkSteps = 0;
+    bool cached = false;
+
+  private:
+    void listCandidates(const ParticleSystem& system);
+    bool lookup();
+    void measure(ParticleSystem& system);
+    void save();
+};
+
+const char* engineName(Engine engine);
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <cmath>
+
+#include "DensityMap.hpp"
+
+DensityMap::DensityMap(uint32_t width, uint32_t height)
+  : width(width), height(height), pixels(width * height, 0), view(0.f, 0.f, width, height) {}
+
+uint32_t DensityMap::getWidth() const          { return width;         }
+uint32_t DensityMap::getHeight() const         { return height;        }
+const uint8_t* DensityMap::getPixels() const { return pixels.data(); }
+
+void DensityMap::setView(const nb::FloatRect& v) {
+  view = v;
+}
+
+static const nb::Vector2f& positionOf(const Particle& p) { return p.getPosition(); }
+static const nb::Vector2f& positionOf(const Splat& s)    { return s.position;      }
+static float massOf(const Particle& p)                   { return p.getMass();     }
+static float massOf(const Splat& s)                      { return s.mass;          }
+
+void DensityMap::accumulate(const std::vector<Particle>& particles, ThreadPool& tp) {
+  scatter(particles, tp);
+  reduce(tp);
+}
+
+void DensityMap::accumulate(const std::vector<Splat>& splats, ThreadPool& tp) {
+  scatter(splats, tp);
+  reduce(tp);
+}
+
+template<class T>
+void DensityMap::scatter(const std::vector<T>& items, ThreadPool& tp) {
+  if (histograms.size() != static_cast<size_t>(tp.size()))
+    histograms.assign(tp.size(), std::vector<float>(width * height, 0.f));
+
+  const float scaleX = width / view.width;
+  const float scaleY = height / view.height;
+
+  tp.parallelFor(items.size(), [this, &items, scaleX, scaleY](size_t begin, size_t end, uint32_t slice) {
+    std::vector<float>& histogram = histograms[slice];
+    for (size_t i = begin; i < end; i++) {
+      const nb::Vector2f& pos = positionOf(items[i]);
+      splat(histogram, {(pos.x - view.left) * scaleX, (pos.y - view.top) * scaleY}, massOf(items[i]));
+    }
+  });
+}
+
+// Sums the histograms, maps them to bytes and clears them for the next frame
+void DensityMap::reduce(ThreadPool& tp) {
+  tp.parallelFor(width * height, [this](size_t begin, size_t end, uint32_t) {
+    for (size_t px = begin; px < end; px++) {
+      float density = 0.f;
+      for (std::vector<float>& histogram : histograms) {
+        density += histogram[px];
+        histogram[px] = 0.f;
+      }
+      pixels[px] = static_cast<uint8_t>(std::min(density * DENSITY_BODY_INTENSITY, 255.f));
+    }
+  });
+}
+
+// Bilinear splat over the 2x2 pixels around the position
+void DensityMap::splat(std::vector<float>& histogram, const nb::Vector2f& pos, float weight) const {
+  float fx = pos.x - 0.5f;
+  float fy = pos.y - 0.5f;
+  float x0 = std::floor(fx);
+  float y0 = std::floor(fy);
+  if (x0 < -1.f || y0 < -1.f || x0 >= width || y0 >= height) return;
+
+  int ix = static_cast<int>(x0);
+  int iy = static_cast<int>(y0);
+  float tx = fx - x0;
+  float ty = fy - y0;
+
+  const float weights[4] = {
+    (1.f - tx) * (1.f - ty) * weight, tx * (1.f - ty) * weight,
+    (1.f - tx) * ty * weight,         tx * ty * weight
+  };
+
+  for (int k = 0; k < 4; k++) {
+    int x = ix + (k & 1);
+    int y = iy + (k >> 1);
+    if (x >= 0 && y >= 0 && x < static_cast<int>(width) && y < static_cast<int>(height))
+      histogram[y * width + x] += weights[k];
+  }
+}
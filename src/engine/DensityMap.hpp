@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include "Particle.hpp"
+
+// A point of light, a body or a whole far away node
+struct Splat {
+  nb::Vector2f position;
+  float mass;
+};
+
+// Brightness image built on the CPU: every body is splatted into the histogram of its worker,
+// the histograms are summed row range by row range and mapped to one byte per pixel
+class DensityMap {
+  public:
+    DensityMap(uint32_t width, uint32_t height);
+
+    [[nodiscard]] uint32_t getWidth() const;
+    [[nodiscard]] uint32_t getHeight() const;
+    [[nodiscard]] const uint8_t* getPixels() const;
+
+    // World rectangle mapped onto the image
+    void setView(const nb::FloatRect& view);
+
+    void accumulate(const std::vector<Particle>& particles, ThreadPool& tp);
+    void accumulate(const std::vector<Splat>& splats, ThreadPool& tp);
+
+  private:
+    const uint32_t width, height;
+    std::vector<std::vector<float>> histograms; // One per worker, zeroed again by the reduction
+    std::vector<uint8_t> pixels;
+    nb::FloatRect view;
+
+  private:
+    template<class T>
+    void scatter(const std::vector<T>& items, ThreadPool& tp);
+    void reduce(ThreadPool& tp);
+    void splat(std::vector<float>& histogram, const nb::Vector2f& pos, float weight) const;
+};
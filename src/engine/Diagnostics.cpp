@@ -0,0 +1,60 @@
+#include "Diagnostics.hpp"
+
+double Diagnostics::energy() const {
+  return kinetic + potential;
+}
+
+Diagnostics Diagnostics::measure(const std::vector<Particle>& particles, const qt::Node* root, const qt::Node* farField, const Variant& variant, ThreadPool& tp) {
+  struct Partial {
+    double kinetic = 0.0;
+    double potential = 0.0;
+    double mass = 0.0;
+    nb::Vector2<double> momentum;
+    nb::Vector2<double> massMoment; // Sum of m * r
+    double angularMomentum = 0.0;   // About the origin
+  };
+
+  std::vector<Partial> partials(tp.size());
+  tp.parallelFor(particles.size(), [&particles, &partials, root, farField, &variant](size_t begin, size_t end, uint32_t slice) {
+    Partial& part = partials[slice];
+    for (size_t j = begin; j < end; j++) {
+      const Particle& p = particles[j];
+      double m = p.getMass();
+      nb::Vector2<double> r{p.getPosition()};
+      nb::Vector2<double> v{p.getVelocity()};
+
+      part.kinetic += 0.5 * m * (v.x * v.x + v.y * v.y);
+      part.mass += m;
+      part.momentum += m * v;
+      part.massMoment += m * r;
+      part.angularMomentum += m * (r.x * v.y - r.y * v.x);
+    }
+
+    // Every pair is counted from both sides
+    part.potential = 0.5 * variant.potentialEnergy(root, particles.data() + begin, particles.data() + end);
+    if (farField) part.potential += 0.5 * variant.potentialEnergy(farField, particles.data() + begin, particles.data() + end);
+  });
+
+  Partial total;
+  for (const Partial& part : partials) {
+    total.kinetic += part.kinetic;
+    total.potential += part.potential;
+    total.mass += part.mass;
+    total.momentum += part.momentum;
+    total.massMoment += part.massMoment;
+    total.angularMomentum += part.angularMomentum;
+  }
+
+  Diagnostics d;
+  d.kinetic = total.kinetic;
+  d.potential = total.potential;
+  d.momentum = total.momentum;
+
+  // L about the center of mass R: sum(m * r x v) - R x P
+  if (total.mass > 0.0) {
+    nb::Vector2<double> com = total.massMoment / total.mass;
+    d.angularMomentum = total.angularMomentum - (com.x * total.momentum.y - com.y * total.momentum.x);
+  }
+
+  return d;
+}
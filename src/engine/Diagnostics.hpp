@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+#include "Variants.hpp"
+
+// Conserved quantities of the whole system (G = 1), angular momentum is taken about the center of mass
+struct Diagnostics {
+  uint32_t step = 0;
+  double kinetic = 0.0;
+  double potential = 0.0;
+  nb::Vector2<double> momentum;
+  double angularMomentum = 0.0;
+
+  [[nodiscard]] double energy() const;
+
+  // The trees must be built from the current positions, the far field may be nullptr
+  static Diagnostics measure(const std::vector<Particle>& particles, const qt::Node* root, const qt::Node* farField, const Variant& variant, ThreadPool& tp);
+};
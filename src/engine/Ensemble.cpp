@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <fstream>
+
+#include "Ensemble.hpp"
+
+Ensemble::Ensemble(uint32_t threads) {
+  tp.start(threads ? threads : std::thread::hardware_concurrency());
+}
+
+Ensemble::~Ensemble() {
+  for (ParticleSystem* m : members)
+    delete m;
+  tp.stop();
+}
+
+ParticleSystem& Ensemble::add(uint32_t bodies) {
+  ParticleSystem* m = new ParticleSystem(bodies, ParticleSystem::serialThreads);
+  m->vertices = {}; // Never drawn
+
+  members.push_back(m);
+  initial.emplace_back();
+  return *m;
+}
+
+void Ensemble::step(float dt) {
+  TRACE_SCOPE("ensemble");
+  buildTrees();
+
+  // Force passes in chunks, so a few members still spread over every worker
+  for (ParticleSystem* m : members)
+    for (size_t begin = 0; begin < m->particles.size(); begin += ENSEMBLE_CHUNK) {
+      size_t end = std::min<size_t>(begin + ENSEMBLE_CHUNK, m->particles.size());
+      tp.queueJob([m, begin, end] { m->updateAttractionThreaded(begin, end); });
+    }
+  tp.waitForCompletion();
+
+  for (ParticleSystem* m : members) {
+    bodySteps += m->particles.size();
+    tp.queueJob([m, dt] {
+      m->updateParticles(dt);
+      if (m->merging) m->mergeCloseEncounters();
+      m->steps++;
+    });
+  }
+  tp.waitForCompletion();
+}
+
+size_t Ensemble::size() const {
+  return members.size();
+}
+
+uint64_t Ensemble::getBodySteps() const {
+  return bodySteps;
+}
+
+void Ensemble::writeSummaries(const char* path) {
+  buildTrees();
+
+  std::vector<Diagnostics> last(members.size());
+  for (size_t i = 0; i < members.size(); i++)
+    tp.queueJob([this, i, &last] {
+      ParticleSystem* m = members[i];
+      last[i] = Diagnostics::measure(m->particles, m->qt, m->farField, *m->variant, m->tp);
+    });
+  tp.waitForCompletion();
+
+  std::ofstream file(path);
+  file << "member,bodies,limit,opening,theta,softening,steps,energy,drift,momentum_x,momentum_y,angular_momentum\n";
+
+  for (size_t i = 0; i < members.size(); i++) {
+    const ParticleSystem* m = members[i];
+    const Diagnostics& d = last[i];
+    double drift = (d.energy() - initial[i].energy()) / std::abs(initial[i].energy());
+
+    file
+      << i << ',' << m->particles.size() << ',' << m->variant->containerLimit << ',' << Variants::name(m->variant->opening) << ',' << m->variant->theta << ','
+      << m->variant->softening << ',' << m->steps << ',' << d.energy() << ',' << drift << ','
+      << d.momentum.x << ',' << d.momentum.y << ',' << d.angularMomentum << '\n';
+  }
+}
+
+void Ensemble::buildTrees() {
+  for (size_t i = 0; i < members.size(); i++)
+    tp.queueJob([this, i] {
+      ParticleSystem* m = members[i];
+      m->updateQuadTree();
+      if (m->steps == 0) initial[i] = Diagnostics::measure(m->particles, m->qt, m->farField, *m->variant, m->tp);
+    });
+  tp.waitForCompletion();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "ParticleSystem.hpp"
+
+// Independent systems stepped together, for sweeps of runs too small to fill a pool on their own. Members have no
+// workers of their own, the phases of all of them are queued on one shared pool: tree builds, then force passes cut
+// into chunks, then integration. Nothing is drawn.
+class Ensemble {
+  public:
+    // 0 threads uses every hardware thread
+    explicit Ensemble(uint32_t threads = 0);
+    ~Ensemble();
+
+    // Spiral of that many bodies, to be configured by the caller (variant, merging) before the first step
+    ParticleSystem& add(uint32_t bodies);
+
+    void step(float dt);
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] uint64_t getBodySteps() const; // Summed over the members since they were added
+
+    // One CSV line per member: its variant, bodies and the drift of the conserved quantities since its first step
+    void writeSummaries(const char* path);
+
+  private:
+    ThreadPool tp;
+    std::vector<ParticleSystem*> members;
+    std::vector<Diagnostics> initial; // Of every member before its first step
+    uint64_t bodySteps = 0;
+
+  private:
+    void buildTrees();
+};
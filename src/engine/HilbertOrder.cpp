@@ -0,0 +1,133 @@
+#include <algorithm>
+
+#include "HilbertOrder.hpp"
+
+uint32_t HilbertOrder::curve(uint32_t x, uint32_t y) {
+  uint32_t d = 0;
+  for (uint32_t s = 0x8000; s > 0; s >>= 1) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+
+    // Rotate the quadrant so the curve continues where the last one ended
+    if (ry == 0) {
+      if (rx == 1) {
+        x = 0xffff - x;
+        y = 0xffff - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+HilbertOrder::HilbertOrder(ThreadPool& tp) : counters(tp) {}
+
+void HilbertOrder::beginForce() {
+  forceStart = counters.read();
+}
+
+void HilbertOrder::endForce(float seconds) {
+  forceCounters = counters.read() - forceStart;
+  forceTime = seconds;
+}
+
+bool HilbertOrder::update(std::vector<Particle>& particles, const nb::FloatRect& box, float stepTime, ThreadPool& tp) {
+  if (reportPending) {
+    report(stepTime);
+    reportPending = false;
+  }
+
+  steps++;
+  sinceReport++;
+  baseline = std::min(baseline, forceTime);
+  lost += forceTime - baseline;
+  if (steps < HILBERT_MIN_INTERVAL || lost <= cost) return false;
+
+  if (sinceReport >= HILBERT_REPORT_INTERVAL) {
+    reportPending = true;
+    sinceReport = 0;
+    beforeForce = forceTime;
+    beforeStep = stepTime;
+    beforeCounters = forceCounters;
+  }
+
+  nb::Clock clock;
+  reorder(particles, box, tp);
+  cost = clock.getElapsedTime().asSeconds();
+
+  interval = steps;
+  steps = 0;
+  baseline = INFINITY;
+  lost = 0.f;
+  return true;
+}
+
+uint32_t HilbertOrder::getInterval() const {
+  return interval;
+}
+
+void HilbertOrder::reorder(std::vector<Particle>& particles, const nb::FloatRect& box, ThreadPool& tp) {
+  TRACE_SCOPE("hilbertReorder");
+  const size_t n = particles.size();
+  const uint32_t slices = tp.size();
+  const float sx = 0xffff / std::max(box.width, 1e-6f);
+  const float sy = 0xffff / std::max(box.height, 1e-6f);
+
+  // 1. Keys, every slice sorts its own. Bodies outside of the box go to its edge.
+  keys.resize(n);
+  bounds.assign(slices + 1, n);
+  tp.parallelFor(n, [&](size_t begin, size_t end, uint32_t slice) {
+    for (size_t i = begin; i < end; i++) {
+      const nb::Vector2f& pos = particles[i].getPosition();
+      uint32_t cx = std::clamp((pos.x - box.left) * sx, 0.f, 65535.f);
+      uint32_t cy = std::clamp((pos.y - box.top) * sy, 0.f, 65535.f);
+      keys[i] = {curve(cx, cy), i};
+    }
+    std::sort(keys.begin() + begin, keys.begin() + end);
+    bounds[slice] = begin;
+  });
+
+  // 2. Sorted runs merged pairwise, the merges of a round in parallel
+  for (uint32_t width = 1; width < slices; width *= 2) {
+    for (uint32_t i = 0; i + width < slices; i += 2 * width) {
+      auto first = keys.begin() + bounds[i];
+      auto middle = keys.begin() + bounds[i + width];
+      auto last = keys.begin() + bounds[std::min(i + 2 * width, slices)];
+      tp.queueJob([first, middle, last] { std::inplace_merge(first, middle, last); });
+    }
+    tp.waitForCompletion();
+  }
+
+  // 3. Gathered into the scratch store. Pinned pools copy it back so the pages stay on the node of their worker.
+  if (scratch.size() != n) scratch = particles;
+  tp.parallelFor(n, [&](size_t begin, size_t end, uint32_t) {
+    for (size_t i = begin; i < end; i++)
+      scratch[i] = particles[keys[i].second];
+  });
+
+  if (tp.isPinned()) {
+    tp.parallelFor(n, [&](size_t begin, size_t end, uint32_t) {
+      std::copy(scratch.begin() + begin, scratch.begin() + end, particles.begin() + begin);
+    });
+  } else {
+    particles.swap(scratch);
+  }
+}
+
+void HilbertOrder::report(float stepTime) const {
+  printf(
+    "Hilbert order: reorder every %u steps (%.3f ms), force %.3f -> %.3f ms, step %.3f -> %.3f ms",
+    interval, cost * 1000.f, beforeForce * 1000.f, forceTime * 1000.f, beforeStep * 1000.f, stepTime * 1000.f
+  );
+
+  if (counters.isAvailable()) {
+    printf(
+      ", L1 miss %.2f%% -> %.2f%%, LLC miss %.2f%% -> %.2f%%\n",
+      beforeCounters.l1MissRate() * 100.0, forceCounters.l1MissRate() * 100.0,
+      beforeCounters.llcMissRate() * 100.0, forceCounters.llcMissRate() * 100.0
+    );
+  } else {
+    printf(", cache counters unavailable\n");
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "Particle.hpp"
+
+// Keeps the particle store sorted along a Hilbert curve, so the bodies of a leaf sit next to each other in memory.
+// The order decays as the bodies move. It is restored once the force passes lost more time to the decay since the
+// last reorder (against the fastest pass since then) than the last reorder took, so the interval follows the measurements.
+class HilbertOrder {
+  public:
+    // Every worker of the pool opens its cache counters, the pool must be idle
+    explicit HilbertOrder(ThreadPool& tp);
+
+    void beginForce();
+    void endForce(float seconds);
+
+    // Before the step builds anything over the bodies. True when they were reordered, indices and pointers to them are stale.
+    bool update(std::vector<Particle>& particles, const nb::FloatRect& box, float stepTime, ThreadPool& tp);
+
+    [[nodiscard]] uint32_t getInterval() const; // Steps between the last two reorders
+
+    // Distance along the curve of a cell of a 2^16 by 2^16 grid
+    static uint32_t curve(uint32_t x, uint32_t y);
+
+  private:
+    PerfCounters counters;
+    PerfCounters::Reading forceStart;
+    PerfCounters::Reading forceCounters; // Of the last force pass
+    float forceTime = 0.f;
+
+    std::vector<std::pair<uint32_t, uint32_t>> keys; // Curve key and index of every body
+    std::vector<uint32_t> bounds;                    // Sorted runs of keys, one per slice
+    std::vector<Particle> scratch;
+
+    uint32_t steps = 0;
+    uint32_t interval = 0;
+    float cost = 0.f;
+    float baseline = INFINITY;
+    float lost = 0.f;
+
+    // Step that led to the last reported reorder, printed along with the step after it
+    uint32_t sinceReport = HILBERT_REPORT_INTERVAL;
+    bool reportPending = false;
+    float beforeForce = 0.f;
+    float beforeStep = 0.f;
+    PerfCounters::Reading beforeCounters;
+
+  private:
+    void reorder(std::vector<Particle>& particles, const nb::FloatRect& box, ThreadPool& tp);
+    void report(float stepTime) const;
+};
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <numeric>
+
+#include "InteractionLists.hpp"
+
+static qt::Rectangle toRectangle(const nb::FloatRect& r) {
+  return {r.left + r.width * 0.5f, r.top + r.height * 0.5f, r.width * 0.5f, r.height * 0.5f};
+}
+
+void InteractionLists::build(const qt::Node* root, const std::vector<Particle>& particles, const Variant& variant, ThreadPool& tp) {
+  std::vector<const qt::Node*> leaves;
+  root->collectLeaves(leaves);
+
+  groups.resize(leaves.size());
+  for (size_t i = 0; i < leaves.size(); i++)
+    groups[i].leaf = leaves[i];
+
+  outside.clear();
+  for (uint32_t i = 0; i < particles.size(); i++)
+    if (!root->contains(&particles[i])) outside.push_back(i);
+
+  bodies = particles.size();
+  walk(root, variant, tp, false);
+  builtCost = cost;
+  rewalked = 0;
+  built = true;
+}
+
+bool InteractionLists::refresh(const qt::Node* root, const std::vector<Particle>& particles, const Variant& variant, ThreadPool& tp) {
+  // Merging moved the bodies the tree points to
+  if (particles.size() != bodies) return false;
+
+  walk(root, variant, tp, true);
+
+  // Rewalks open more cells as the tree ages, past some point a fresh one is cheaper
+  return cost <= builtCost * INTERACTION_LIST_MAX_GROWTH;
+}
+
+uint64_t InteractionLists::solve(qt::Node* root, std::vector<Particle>& particles, const Variant& variant, ThreadPool& tp) const {
+  tp.parallelFor(groups.size(), [this, &variant](size_t begin, size_t end, uint32_t) {
+    for (size_t i = begin; i < end; i++)
+      variant.solveInteractions(groups[i].leaf, groups[i].far, groups[i].near);
+  });
+
+  // The costs count every body of the near leaves, the bodies themselves included
+  uint64_t interactions = cost;
+  for (uint32_t i : outside)
+    interactions += variant.solveAttraction(root, &particles[i], &particles[i] + 1);
+
+  return interactions;
+}
+
+void InteractionLists::invalidate() {
+  built = false;
+}
+
+bool InteractionLists::isBuilt() const {
+  return built;
+}
+
+uint32_t InteractionLists::getRewalked() const {
+  return rewalked;
+}
+
+void InteractionLists::walk(const qt::Node* root, const Variant& variant, ThreadPool& tp, bool brokenOnly) {
+  rewalks.assign(tp.size(), 0);
+
+  tp.parallelFor(groups.size(), [&](size_t begin, size_t end, uint32_t slice) {
+    for (size_t i = begin; i < end; i++) {
+      Group& g = groups[i];
+      qt::Rectangle bounds = toRectangle(g.leaf->bodyBounds());
+
+      // Decisions were made with a stricter theta, they only break once drift used up the margin
+      if (brokenOnly && std::all_of(g.far.begin(), g.far.end(), [&](const qt::Node* n) { return n->isFarFrom(bounds, variant.groupTheta); }))
+        continue;
+
+      g.far.clear();
+      g.near.clear();
+      variant.collectInteractions(root, bounds, g.far, g.near);
+
+      g.cost = g.far.size();
+      for (const qt::Node* leaf : g.near) g.cost += leaf->bodyCount();
+      g.cost *= g.leaf->bodyCount();
+      rewalks[slice]++;
+    }
+  });
+
+  if (brokenOnly) rewalked += std::accumulate(rewalks.begin(), rewalks.end(), 0u);
+
+  cost = 0;
+  for (const Group& g : groups) cost += g.cost;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "quadtree.hpp"
+#include "Variants.hpp"
+
+// Opening decisions of every leaf of the tree, kept across steps. The tree keeps its structure and only the moments
+// are refitted. Each step a group checks its far nodes against where the bodies are now and rewalks the tree once
+// the drift broke one of them.
+class InteractionLists {
+  public:
+    struct Group {
+      const qt::Node* leaf;
+      std::vector<const qt::Node*> far;  // Taken as one mass
+      std::vector<const qt::Node*> near; // Leaves summed body by body
+      size_t cost;                       // Interactions of all the bodies
+    };
+
+    // Right after a fresh tree build
+    void build(const qt::Node* root, const std::vector<Particle>& particles, const Variant& variant, ThreadPool& tp);
+
+    // After the moments were refitted, rewalks the groups the drift broke. False when the tree needs a rebuild instead.
+    bool refresh(const qt::Node* root, const std::vector<Particle>& particles, const Variant& variant, ThreadPool& tp);
+
+    // Number of interactions it took
+    uint64_t solve(qt::Node* root, std::vector<Particle>& particles, const Variant& variant, ThreadPool& tp) const;
+
+    void invalidate();
+    [[nodiscard]] bool isBuilt() const;
+    [[nodiscard]] uint32_t getRewalked() const; // Groups walked again since the build
+
+  private:
+    std::vector<Group> groups;
+    std::vector<uint32_t> outside;  // Bodies the tree left out, they walk it as usual
+    std::vector<uint32_t> rewalks;  // Per slice
+    size_t bodies = 0;
+    size_t cost = 0;
+    size_t builtCost = 0;
+    uint32_t rewalked = 0;
+    bool built = false;
+
+  private:
+    void walk(const qt::Node* root, const Variant& variant, ThreadPool& tp, bool brokenOnly);
+};
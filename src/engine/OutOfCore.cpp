@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "OutOfCore.hpp"
+#include "Spawner.hpp"
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Geometric test of the variant's groups, for summaries that have no node to test
+static bool isFar(const Variant* variant, float s, float d) {
+  return s / (d + variant->softening) < variant->groupTheta;
+}
+
+static nb::Vector2f lowest(const nb::Vector2f& a, const nb::Vector2f& b) {
+  return {std::min(a.x, b.x), std::min(a.y, b.y)};
+}
+
+static nb::Vector2f highest(const nb::Vector2f& a, const nb::Vector2f& b) {
+  return {std::max(a.x, b.x), std::max(a.y, b.y)};
+}
+
+OutOfCore::OutOfCore(const char* path, uint64_t bodies, size_t budget, uint32_t threads) : path(path) {
+  tp.start(threads ? threads : std::thread::hardware_concurrency());
+  count = Spawner::spiralSize(bodies);
+
+  // A resident body costs its record in both copies, the particle it is loaded into and about a node of the near tree
+  const size_t perBody = 2 * sizeof(Body) + sizeof(Particle) + sizeof(qt::Node);
+  tileBodies = std::max<uint64_t>(OOC_MIN_TILE_BODIES, budget / (perBody * OOC_RESIDENT_TILES));
+  tileBodies = std::min(tileBodies, std::max<uint64_t>(count, 1));
+  local.reserve(tileBodies * OOC_RESIDENT_TILES); // Only touched as near sets grow, never moved in between
+
+#ifdef __unix__
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  mappedBytes = 2 * count * sizeof(Body);
+  if (fd < 0 || count == 0 || ftruncate(fd, mappedBytes) != 0) {
+    printf("Could not create %s for %llu bodies\n", path, static_cast<unsigned long long>(count));
+    return;
+  }
+
+  void* m = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    printf("Could not map %s\n", path);
+    return;
+  }
+
+  mapping = static_cast<Body*>(m);
+  current = mapping;
+  next = mapping + count;
+
+  generate();
+  sort();
+#else
+  printf("Out-of-core runs need mmap, %s is not created on this platform\n", path);
+#endif
+}
+
+OutOfCore::~OutOfCore() {
+#ifdef __unix__
+  if (mapping) munmap(mapping, mappedBytes);
+  if (fd >= 0) {
+    close(fd);
+    unlink(path);
+  }
+#endif
+  tp.stop();
+}
+
+bool OutOfCore::isOpen() const {
+  return mapping != nullptr;
+}
+
+void OutOfCore::step(float dt) {
+  if (steps > 0 && steps % OOC_SORT_INTERVAL == 0) sort();
+  summarize();
+  buildCoarseTree();
+  findNear();
+
+  for (uint32_t t = 0; t < tiles.size(); t++) {
+    const Tile& tile = tiles[t];
+    if (tile.begin == tile.end) continue;
+
+    makeResident(t);
+    qt::Node* root = load(t);
+    Particle* bodies = local.data();
+    const size_t n = tile.end - tile.begin;
+
+    // Every force before any body moves, the near tree is built over the positions of this step
+    tp.parallelFor(n, [&](size_t begin, size_t end, uint32_t) {
+      variant->solveAttraction(root, bodies + begin, bodies + end);
+      for (size_t i = begin; i < end; i++)
+        solveFar(t, levels.size() - 1, 0, bodies[i]);
+    });
+
+    tp.parallelFor(n, [&](size_t begin, size_t end, uint32_t) {
+      for (size_t i = begin; i < end; i++) {
+        bodies[i].update(dt);
+        next[tile.begin + i] = {bodies[i].getPosition(), bodies[i].getVelocity(), bodies[i].getMass()};
+      }
+    });
+
+    delete root;
+    release(next, tile.begin, tile.end); // Written back by the kernel, only dirty until then
+    measureRss();
+  }
+
+  makeResident(tiles.size()); // Past the last tile, nothing stays resident
+  std::swap(current, next);
+  steps++;
+}
+
+double OutOfCore::forceError(uint32_t samples) {
+  if (!isOpen() || samples == 0) return 0.0;
+
+  summarize();
+  buildCoarseTree();
+  findNear();
+
+  // Samples spread evenly over the file, so over the tiles too
+  const uint64_t stride = std::max<uint64_t>(1, count / samples);
+  std::vector<uint64_t> indices;
+  for (uint64_t i = stride / 2; i < count && indices.size() < samples; i += stride)
+    indices.push_back(i);
+
+  std::vector<nb::Vector2f> approximate(indices.size());
+  size_t s = 0;
+  for (uint32_t t = 0; t < tiles.size() && s < indices.size(); t++) {
+    if (indices[s] >= tiles[t].end) continue;
+
+    makeResident(t);
+    qt::Node* root = load(t);
+    for (; s < indices.size() && indices[s] < tiles[t].end; s++) {
+      Particle& p = local[indices[s] - tiles[t].begin];
+      variant->solveAttraction(root, &p, &p + 1);
+      solveFar(t, levels.size() - 1, 0, p);
+      approximate[s] = p.getAcceleration();
+    }
+    delete root;
+  }
+  makeResident(tiles.size());
+
+  // Direct sums, the file streamed once for all the samples
+  std::vector<Particle> exact;
+  for (uint64_t i : indices) exact.emplace_back(current[i].position, current[i].mass);
+
+  for (uint64_t begin = 0; begin < count; begin += tileBodies) {
+    const uint64_t end = std::min(count, begin + tileBodies);
+    tp.parallelFor(exact.size(), [&](size_t first, size_t last, uint32_t) {
+      for (size_t k = first; k < last; k++)
+        for (uint64_t i = begin; i < end; i++)
+          if (i != indices[k]) exact[k].attractTo(current[i].position, current[i].mass);
+    });
+    release(current, begin, end);
+  }
+
+  double error = 0.0;
+  for (size_t k = 0; k < exact.size(); k++) {
+    nb::Vector2f a = exact[k].getAcceleration();
+    nb::Vector2f e = approximate[k] - a;
+    float magnitude = std::sqrt(a.x * a.x + a.y * a.y);
+    if (magnitude > 0.f) error += std::sqrt(e.x * e.x + e.y * e.y) / magnitude;
+  }
+  return error / exact.size();
+}
+
+uint64_t OutOfCore::size() const {
+  return count;
+}
+
+uint32_t OutOfCore::getTileCount() const {
+  return tiles.size();
+}
+
+uint64_t OutOfCore::getTileBodies() const {
+  return tileBodies;
+}
+
+uint32_t OutOfCore::getMostResident() const {
+  return mostResident;
+}
+
+size_t OutOfCore::getPeakRss() const {
+  return peakRss;
+}
+
+size_t OutOfCore::residentBytes() {
+#ifdef __unix__
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (!statm) return 0;
+
+  unsigned long long pages = 0, resident = 0;
+  int read = fscanf(statm, "%llu %llu", &pages, &resident);
+  fclose(statm);
+  return read == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+  return 0;
+#endif
+}
+
+size_t OutOfCore::availableBytes() {
+#ifdef __unix__
+  FILE* meminfo = fopen("/proc/meminfo", "r");
+  if (!meminfo) return 0;
+
+  char line[256];
+  unsigned long long kb = 0;
+  while (fgets(line, sizeof(line), meminfo))
+    if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) break;
+  fclose(meminfo);
+  return kb << 10;
+#else
+  return 0;
+#endif
+}
+
+void OutOfCore::generate() {
+  const nb::Vector2f center = {WIDTH * 0.5f, HEIGHT * 0.5f};
+
+  for (uint64_t begin = 0; begin < count; begin += tileBodies) {
+    const uint64_t end = std::min(count, begin + tileBodies);
+    local.clear();
+    Spawner::spiral(local, center, count, begin, end);
+
+    for (uint64_t i = begin; i < end; i++) {
+      const Particle& p = local[i - begin];
+      current[i] = {p.getPosition(), p.getVelocity(), p.getMass()};
+    }
+    release(current, begin, end);
+  }
+}
+
+void OutOfCore::sort() {
+  const uint32_t tileCount = (count + tileBodies - 1) / tileBodies;
+  const uint32_t slices = tp.size();
+
+  // 1. Box of every body, one window at a time
+  Extent box = {current[0].position, current[0].position};
+  std::vector<Extent> sliceBoxes(slices);
+  for (uint64_t begin = 0; begin < count; begin += tileBodies) {
+    const uint64_t end = std::min(count, begin + tileBodies);
+    std::fill(sliceBoxes.begin(), sliceBoxes.end(), box);
+    tp.parallelFor(end - begin, [&](size_t first, size_t last, uint32_t slice) {
+      Extent& b = sliceBoxes[slice];
+      for (size_t i = begin + first; i < begin + last; i++) {
+        b.min = lowest(b.min, current[i].position);
+        b.max = highest(b.max, current[i].position);
+      }
+    });
+    for (const Extent& b : sliceBoxes) box = {lowest(box.min, b.min), highest(box.max, b.max)};
+    release(current, begin, end);
+  }
+
+  // 2. Tiles start at quantiles of the keys of a sample, so they hold about tileBodies each
+  const uint64_t stride = std::max<uint64_t>(1, count / OOC_SORT_SAMPLES);
+  std::vector<uint32_t> sampled;
+  for (uint64_t i = 0; i < count; i += stride)
+    sampled.push_back(key(current[i].position, box));
+  release(current, 0, count);
+  std::sort(sampled.begin(), sampled.end());
+
+  splitters.resize(tileCount - 1);
+  for (uint32_t t = 1; t < tileCount; t++)
+    splitters[t - 1] = sampled[t * sampled.size() / tileCount];
+
+  // 3. Bodies per tile, then per slice of every window, and scattered to where their tile is written
+  tileOf.resize(tileBodies);
+  sliceCounts.assign(slices, std::vector<uint64_t>(tileCount));
+  std::vector<uint64_t> total(tileCount, 0);
+
+  auto classify = [&](uint64_t begin, uint64_t end) {
+    for (std::vector<uint64_t>& c : sliceCounts) std::fill(c.begin(), c.end(), 0);
+    tp.parallelFor(end - begin, [&](size_t first, size_t last, uint32_t slice) {
+      for (size_t i = first; i < last; i++) {
+        uint32_t k = key(current[begin + i].position, box);
+        tileOf[i] = std::upper_bound(splitters.begin(), splitters.end(), k) - splitters.begin();
+        sliceCounts[slice][tileOf[i]]++;
+      }
+    });
+  };
+
+  for (uint64_t begin = 0; begin < count; begin += tileBodies) {
+    const uint64_t end = std::min(count, begin + tileBodies);
+    classify(begin, end);
+    for (const std::vector<uint64_t>& c : sliceCounts)
+      for (uint32_t t = 0; t < tileCount; t++) total[t] += c[t];
+    release(current, begin, end);
+  }
+
+  tiles.assign(tileCount, {});
+  std::vector<uint64_t> written(tileCount), released(tileCount);
+  for (uint64_t t = 0, offset = 0; t < tileCount; offset += total[t], t++) {
+    tiles[t].begin = offset;
+    tiles[t].end = offset + total[t];
+    written[t] = released[t] = offset;
+  }
+
+  for (uint64_t begin = 0; begin < count; begin += tileBodies) {
+    const uint64_t end = std::min(count, begin + tileBodies);
+    classify(begin, end);
+
+    // Slices write one after the other within every tile, so where each starts is known before any writes
+    for (uint32_t s = 0; s < slices; s++)
+      for (uint32_t t = 0; t < tileCount; t++) {
+        uint64_t c = sliceCounts[s][t];
+        sliceCounts[s][t] = written[t];
+        written[t] += c;
+      }
+
+    tp.parallelFor(end - begin, [&](size_t first, size_t last, uint32_t slice) {
+      std::vector<uint64_t>& at = sliceCounts[slice];
+      for (size_t i = first; i < last; i++)
+        next[at[tileOf[i]]++] = current[begin + i];
+    });
+
+    release(current, begin, end);
+    for (uint32_t t = 0; t < tileCount; t++) {
+      release(next, released[t], written[t]);
+      released[t] = written[t];
+    }
+  }
+
+  std::swap(current, next);
+}
+
+void OutOfCore::summarize() {
+  const uint32_t slices = tp.size();
+  const uint32_t cellCount = OOC_TILE_CELLS * OOC_TILE_CELLS;
+  cells.assign(tiles.size() * cellCount, {{0.f, 0.f}, 0.f});
+
+  // Sums in double, a tile may hold millions of bodies
+  struct Sum {
+    double x = 0.0, y = 0.0, mass = 0.0;
+  };
+  std::vector<Extent> sliceBoxes(slices);
+  std::vector<std::vector<Sum>> sliceCells(slices, std::vector<Sum>(cellCount + 1)); // The last one is the tile's
+
+  for (uint32_t t = 0; t < tiles.size(); t++) {
+    Tile& tile = tiles[t];
+    if (tile.begin == tile.end) {
+      tile.bounds = {{0.f, 0.f}, {0.f, 0.f}};
+      tile.gravity = {{0.f, 0.f}, 0.f};
+      tile.cellWidth = 0.f;
+      continue;
+    }
+
+    const Body* bodies = current + tile.begin;
+    const size_t n = tile.end - tile.begin;
+
+    std::fill(sliceBoxes.begin(), sliceBoxes.end(), Extent{bodies[0].position, bodies[0].position});
+    tp.parallelFor(n, [&](size_t begin, size_t end, uint32_t slice) {
+      Extent& b = sliceBoxes[slice];
+      for (size_t i = begin; i < end; i++) {
+        b.min = lowest(b.min, bodies[i].position);
+        b.max = highest(b.max, bodies[i].position);
+      }
+    });
+
+    tile.bounds = sliceBoxes[0];
+    for (const Extent& b : sliceBoxes) tile.bounds = {lowest(tile.bounds.min, b.min), highest(tile.bounds.max, b.max)};
+    const nb::Vector2f extent = tile.bounds.max - tile.bounds.min;
+    tile.cellWidth = std::max(std::max(extent.x, extent.y) / OOC_TILE_CELLS, 1e-3f);
+
+    for (std::vector<Sum>& c : sliceCells) std::fill(c.begin(), c.end(), Sum{});
+    tp.parallelFor(n, [&](size_t begin, size_t end, uint32_t slice) {
+      std::vector<Sum>& c = sliceCells[slice];
+      for (size_t i = begin; i < end; i++) {
+        const Body& b = bodies[i];
+        uint32_t cx = std::min<uint32_t>(OOC_TILE_CELLS - 1, (b.position.x - tile.bounds.min.x) / tile.cellWidth);
+        uint32_t cy = std::min<uint32_t>(OOC_TILE_CELLS - 1, (b.position.y - tile.bounds.min.y) / tile.cellWidth);
+        for (Sum* s : {&c[cy * OOC_TILE_CELLS + cx], &c[cellCount]}) {
+          s->x += b.position.x * b.mass;
+          s->y += b.position.y * b.mass;
+          s->mass += b.mass;
+        }
+      }
+    });
+
+    for (uint32_t k = 0; k <= cellCount; k++) {
+      Sum s;
+      for (const std::vector<Sum>& c : sliceCells) {
+        s.x += c[k].x; s.y += c[k].y; s.mass += c[k].mass;
+      }
+      qt::Node::Gravity g = {{0.f, 0.f}, 0.f};
+      if (s.mass > 0.0) g = {{static_cast<float>(s.x / s.mass), static_cast<float>(s.y / s.mass)}, static_cast<float>(s.mass)};
+
+      if (k == cellCount) tile.gravity = g;
+      else cells[t * cellCount + k] = g;
+    }
+
+    release(current, tile.begin, tile.end);
+  }
+}
+
+void OutOfCore::buildCoarseTree() {
+  // Both the lowest level and the ones above group OOC_GROUP_FANOUT consecutive nodes of the level below
+  levels.clear();
+  uint32_t below = tiles.size();
+
+  do {
+    const bool lowestLevel = levels.empty();
+    std::vector<Group> level;
+
+    for (uint32_t first = 0; first < below; first += OOC_GROUP_FANOUT) {
+      Group g{};
+      g.firstChild = first;
+      g.endChild = std::min<uint32_t>(below, first + OOC_GROUP_FANOUT);
+
+      double x = 0.0, y = 0.0, mass = 0.0;
+      bool empty = true;
+      for (uint32_t c = g.firstChild; c < g.endChild; c++) {
+        const Extent& bounds = lowestLevel ? tiles[c].bounds : levels.back()[c].bounds;
+        const qt::Node::Gravity& gravity = lowestLevel ? tiles[c].gravity : levels.back()[c].gravity;
+        if (gravity.mass <= 0.f) continue;
+
+        g.bounds = empty ? bounds : Extent{lowest(g.bounds.min, bounds.min), highest(g.bounds.max, bounds.max)};
+        empty = false;
+        x += gravity.center.x * gravity.mass;
+        y += gravity.center.y * gravity.mass;
+        mass += gravity.mass;
+      }
+
+      g.firstTile = lowestLevel ? g.firstChild : levels.back()[g.firstChild].firstTile;
+      g.endTile = lowestLevel ? g.endChild : levels.back()[g.endChild - 1].endTile;
+      if (mass > 0.0) g.gravity = {{static_cast<float>(x / mass), static_cast<float>(y / mass)}, static_cast<float>(mass)};
+      level.push_back(g);
+    }
+
+    below = level.size();
+    levels.push_back(std::move(level));
+  } while (below > 1);
+}
+
+void OutOfCore::findNear() {
+  // Every cell of a tile is a pseudo-body for bodies of another: it must be far enough for any of them, as
+  // judged by the box of the tile they are in. Tiles closer than that are summed body by body.
+  nearSets.assign(tiles.size(), {});
+
+  tp.parallelFor(tiles.size(), [&](size_t begin, size_t end, uint32_t) {
+    for (size_t t = begin; t < end; t++) {
+      if (tiles[t].begin == tiles[t].end) continue;
+
+      std::vector<uint32_t>& near = nearSets[t];
+      near.push_back(t);
+      for (uint32_t u = 0; u < tiles.size(); u++) {
+        if (u == t || tiles[u].begin == tiles[u].end) continue;
+        if (!isFar(variant, tiles[u].cellWidth, distance(tiles[t].bounds, tiles[u].bounds)))
+          near.push_back(u);
+      }
+    }
+  });
+}
+
+void OutOfCore::makeResident(uint32_t t) {
+  // This tile's near set, and the next one's which is prefetched while this one is solved
+  std::vector<uint32_t> wanted;
+  if (t < tiles.size()) wanted = nearSets[t];
+  if (t + 1 < tiles.size()) wanted.insert(wanted.end(), nearSets[t + 1].begin(), nearSets[t + 1].end());
+  std::sort(wanted.begin(), wanted.end());
+  wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+  for (uint32_t u : resident)
+    if (!std::binary_search(wanted.begin(), wanted.end(), u)) release(current, tiles[u].begin, tiles[u].end);
+
+#ifdef __unix__
+  if (t + 1 < tiles.size()) {
+    // Read ahead by the kernel, asynchronously
+    for (uint32_t u : nearSets[t + 1]) {
+      if (std::binary_search(resident.begin(), resident.end(), u)) continue;
+      const long page = sysconf(_SC_PAGESIZE);
+      uintptr_t first = reinterpret_cast<uintptr_t>(current + tiles[u].begin) / page * page;
+      uintptr_t last = reinterpret_cast<uintptr_t>(current + tiles[u].end);
+      madvise(reinterpret_cast<void*>(first), last - first, MADV_WILLNEED);
+    }
+  }
+#endif
+
+  resident = std::move(wanted);
+  mostResident = std::max<uint32_t>(mostResident, resident.size());
+}
+
+void OutOfCore::release(const Body* bodies, uint64_t begin, uint64_t end) {
+#ifdef __unix__
+  if (begin >= end) return;
+
+  // A read fault maps in the cached pages around it too, so the range is rounded out to OOC_RELEASE_BLOCK. The file
+  // keeps what was written, edge pages shared with a tile still in use only fault back in.
+  const uintptr_t block = std::max<uintptr_t>(sysconf(_SC_PAGESIZE), OOC_RELEASE_BLOCK);
+  uintptr_t first = reinterpret_cast<uintptr_t>(bodies + begin) / block * block;
+  uintptr_t last = (reinterpret_cast<uintptr_t>(bodies + end) + block - 1) / block * block;
+  first = std::max(first, reinterpret_cast<uintptr_t>(mapping));
+  last = std::min(last, reinterpret_cast<uintptr_t>(mapping) + mappedBytes);
+  if (first < last) madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+#endif
+}
+
+qt::Node* OutOfCore::load(uint32_t t) {
+  const std::vector<uint32_t>& near = nearSets[t];
+
+  uint64_t total = 0;
+  Extent box = tiles[t].bounds;
+  for (uint32_t u : near) {
+    total += tiles[u].end - tiles[u].begin;
+    box = {lowest(box.min, tiles[u].bounds.min), highest(box.max, tiles[u].bounds.max)};
+  }
+
+  // Bodies of the tile first, so they are the ones solved
+  local.assign(total, Particle({0.f, 0.f}));
+  uint64_t offset = 0;
+  for (uint32_t u : near) {
+    const Body* bodies = current + tiles[u].begin;
+    tp.parallelFor(tiles[u].end - tiles[u].begin, [&](size_t begin, size_t end, uint32_t) {
+      for (size_t i = begin; i < end; i++) {
+        Particle& p = local[offset + i];
+        p = Particle(bodies[i].position, bodies[i].mass);
+        p.setVelocity(bodies[i].velocity);
+      }
+    });
+    offset += tiles[u].end - tiles[u].begin;
+  }
+
+  float half = std::max(box.max.x - box.min.x, box.max.y - box.min.y) * 0.5f + 1.f;
+  nb::Vector2f c = (box.min + box.max) * 0.5f;
+  qt::Node* root = new qt::Node(qt::Rectangle(c.x, c.y, half, half));
+  variant->insert(root, local);
+  root->refit();
+  return root;
+}
+
+uint64_t OutOfCore::solveFar(uint32_t t, uint32_t level, uint32_t group, Particle& p) const {
+  const Group& g = levels[level][group];
+  if (g.gravity.mass <= 0.f) return 0;
+
+  // Groups holding a near tile are always opened, the near tree already has those bodies
+  const std::vector<uint32_t>& near = nearSets[t];
+  const bool holdsNear = std::any_of(near.begin(), near.end(), [&g](uint32_t u) { return u >= g.firstTile && u < g.endTile; });
+
+  if (!holdsNear) {
+    const nb::Vector2f extent = g.bounds.max - g.bounds.min;
+    if (isFar(variant, std::max(extent.x, extent.y), qt::mag(g.gravity.center, p.getPosition()))) {
+      p.attractTo(g.gravity.center, g.gravity.mass);
+      return 1;
+    }
+  }
+
+  uint64_t interactions = 0;
+  if (level > 0) {
+    for (uint32_t c = g.firstChild; c < g.endChild; c++)
+      interactions += solveFar(t, level - 1, c, p);
+    return interactions;
+  }
+
+  const uint32_t cellCount = OOC_TILE_CELLS * OOC_TILE_CELLS;
+  for (uint32_t u = g.firstTile; u < g.endTile; u++) {
+    const Tile& tile = tiles[u];
+    if (tile.gravity.mass <= 0.f || std::find(near.begin(), near.end(), u) != near.end()) continue;
+
+    const nb::Vector2f extent = tile.bounds.max - tile.bounds.min;
+    if (isFar(variant, std::max(extent.x, extent.y), qt::mag(tile.gravity.center, p.getPosition()))) {
+      p.attractTo(tile.gravity.center, tile.gravity.mass);
+      interactions++;
+      continue;
+    }
+
+    for (uint32_t k = 0; k < cellCount; k++) {
+      const qt::Node::Gravity& cell = cells[u * cellCount + k];
+      if (cell.mass <= 0.f) continue;
+      p.attractTo(cell.center, cell.mass);
+      interactions++;
+    }
+  }
+  return interactions;
+}
+
+void OutOfCore::measureRss() {
+  peakRss = std::max(peakRss, residentBytes());
+}
+
+uint32_t OutOfCore::key(const nb::Vector2f& position, const Extent& box) {
+  const float scale = 65535.f / std::max(std::max(box.max.x - box.min.x, box.max.y - box.min.y), 1e-3f);
+  uint32_t x = std::min(65535.f, std::max(0.f, (position.x - box.min.x) * scale));
+  uint32_t y = std::min(65535.f, std::max(0.f, (position.y - box.min.y) * scale));
+  return HilbertOrder::curve(x, y);
+}
+
+float OutOfCore::distance(const Extent& a, const Extent& b) {
+  float dx = std::max(0.f, std::max(a.min.x - b.max.x, b.min.x - a.max.x));
+  float dy = std::max(0.f, std::max(a.min.y - b.max.y, b.min.y - a.max.y));
+  return std::sqrt(dx * dx + dy * dy);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+
+#include "HilbertOrder.hpp"
+#include "Variants.hpp"
+
+// Bodies kept in a memory-mapped file rather than in memory, for runs larger than RAM. The file holds the state twice,
+// every step reads one copy and writes the other. Bodies are sorted into tiles of equal count along a Hilbert curve,
+// and a step visits the tiles in that order. Only a tile and its near tiles are resident: they are summed through a
+// tree as usual. Everything farther comes from a coarse tree of moments that stays in memory: tiles grouped along the
+// curve, and a grid of cells inside every tile. The near tiles of the next tile are prefetched while one is solved.
+// Unix only.
+class OutOfCore {
+  public:
+    // Spiral of about that many bodies, written to path one tile at a time. Tiles are sized so the resident ones fit
+    // in budget bytes. 0 threads uses every hardware thread. The file is removed by the destructor.
+    OutOfCore(const char* path, uint64_t bodies, size_t budget, uint32_t threads = 0);
+    ~OutOfCore();
+
+    [[nodiscard]] bool isOpen() const;
+
+    void step(float dt);
+
+    // Mean relative error of the forces on that many bodies spread over the tiles, against the direct sum over
+    // every body. Streams the whole file once.
+    double forceError(uint32_t samples);
+
+    [[nodiscard]] uint64_t size() const;
+    [[nodiscard]] uint32_t getTileCount() const;
+    [[nodiscard]] uint64_t getTileBodies() const;
+    [[nodiscard]] uint32_t getMostResident() const; // Tiles resident at once, most of any tile since the start
+    [[nodiscard]] size_t getPeakRss() const;        // Bytes, highest resident set seen between two tiles
+
+    // Resident set of the whole process in bytes, 0 where it can not be read
+    static size_t residentBytes();
+    // Memory the system can hand out without swapping, page cache included, 0 where it can not be read
+    static size_t availableBytes();
+
+  private:
+    // What the file holds of a body
+    struct Body {
+      nb::Vector2f position;
+      nb::Vector2f velocity;
+      float mass;
+    };
+
+    struct Extent {
+      nb::Vector2f min, max;
+    };
+
+    struct Tile {
+      uint64_t begin, end; // Bodies in the file
+      Extent bounds;
+      qt::Node::Gravity gravity;
+      float cellWidth;
+    };
+
+    // Node of the coarse tree, a run of consecutive tiles
+    struct Group {
+      uint32_t firstTile, endTile;
+      uint32_t firstChild, endChild; // In the level below, tiles for the lowest level
+      Extent bounds;
+      qt::Node::Gravity gravity;
+    };
+
+    const char* path;
+    int fd = -1;
+    Body* mapping = nullptr;
+    size_t mappedBytes = 0;
+    Body* current = nullptr; // Read by this step
+    Body* next = nullptr;    // Written by this step
+    uint64_t count = 0;
+
+    ThreadPool tp;
+    const Variant* variant = &Variants::table[Variants::defaultIndex()];
+    uint32_t steps = 0;
+
+    uint64_t tileBodies = 0;
+    std::vector<Tile> tiles;
+    std::vector<qt::Node::Gravity> cells;  // OOC_TILE_CELLS squared per tile, massless when empty
+    std::vector<std::vector<Group>> levels; // Of the coarse tree, the root level last
+
+    // Near tiles of every tile, itself first then sorted
+    std::vector<std::vector<uint32_t>> nearSets;
+    std::vector<uint32_t> resident; // Tiles whose pages may be mapped in, sorted
+    std::vector<Particle> local;
+    uint32_t mostResident = 0;
+    size_t peakRss = 0;
+
+    // Sort
+    std::vector<uint32_t> splitters;   // Hilbert keys the tiles start at
+    std::vector<uint32_t> tileOf;      // Of every body of the window
+    std::vector<std::vector<uint64_t>> sliceCounts;
+
+  private:
+    void generate();
+    void sort();
+    void summarize();
+    void buildCoarseTree();
+    void findNear();
+    void makeResident(uint32_t t);
+    void release(const Body* bodies, uint64_t begin, uint64_t end);
+    qt::Node* load(uint32_t t); // Near tree over the resident bodies
+    uint64_t solveFar(uint32_t t, uint32_t level, uint32_t group, Particle& p) const;
+    void measureRss();
+
+    [[nodiscard]] static uint32_t key(const nb::Vector2f& position, const Extent& box);
+    [[nodiscard]] static float distance(const Extent& a, const Extent& b);
+};
@@ -1,8 +1,6 @@
-#include <cmath>
-
 #include "Particle.hpp"
 
-Particle::Particle(sf::Vector2f position, float mass, float radius, sf::Color color)
+Particle::Particle(nb::Vector2f position, float mass, float radius, nb::Color color)
   : position(position), mass(mass), radius(radius) {
 
   vertices[0].texCoords = {0.f, 0.f};
@@ -16,43 +14,57 @@ Particle::Particle(sf::Vector2f position, float mass, float radius, sf::Color co
   vertices[3].color = color;
 }
 
-const sf::Vector2f& Particle::getPosition() const    { return position; }
-const sf::Vector2f& Particle::getVelocity() const    { return velocity; }
-const float& Particle::getMass() const               { return mass;     }
-const sf::VertexArray& Particle::getVertices() const { return vertices; }
+const nb::Vector2f& Particle::getPosition() const     { return position;     }
+const nb::Vector2f& Particle::getVelocity() const     { return velocity;     }
+const nb::Vector2f& Particle::getAcceleration() const { return acceleration; }
+float Particle::getLastAcceleration() const           { return lastAcceleration; }
+const float& Particle::getMass() const                { return mass;         }
+const float& Particle::getRadius() const              { return radius;       }
+const nb::Vertex* Particle::getVertices() const       { return vertices;     }
+
+void Particle::setVelocity(nb::Vector2f v) {
+  velocity = v;
+}
 
 void Particle::update(float dt) {
   updatePosition(dt);
   updatePositionVertices();
 }
 
-void Particle::update(sf::Vector2f pos) {
+void Particle::update(nb::Vector2f pos) {
   updatePosition(pos);
   updatePositionVertices();
 }
 
-void Particle::attractTo(const sf::Vector2f& attractorPos, const float& attractorMass) {
-  sf::Vector2f v = attractorPos - position;
-  float magSq = v.x * v.x + v.y * v.y;
-  float mag = std::sqrt(magSq);
+void Particle::merge(const Particle& other) {
+  float m = mass + other.mass;
+  float w1 = mass / m;
+  float w2 = other.mass / m;
 
-  acceleration += attractorMass / (magSq * mag + ZERO_DIVISION_PREVENT_VALUE) * v;
+  position = position * w1 + other.position * w2;
+  velocity = velocity * w1 + other.velocity * w2;
+  acceleration = acceleration * w1 + other.acceleration * w2;
+  radius = std::sqrt(radius * radius + other.radius * other.radius);
+  mass = m;
+
+  updatePositionVertices();
 }
 
 void Particle::updatePosition(float dt) {
   position += velocity * dt;
   velocity += acceleration * dt;
+  lastAcceleration = std::sqrt(acceleration.x * acceleration.x + acceleration.y * acceleration.y);
   acceleration = {0.f, 0.f};
 }
 
-void Particle::updatePosition(sf::Vector2f pos) {
+void Particle::updatePosition(nb::Vector2f pos) {
   position = pos;
 }
 
 void Particle::updatePositionVertices() {
-  vertices[0].position = position + sf::Vector2f{-radius, -radius};
-  vertices[1].position = position + sf::Vector2f{ radius, -radius};
-  vertices[2].position = position + sf::Vector2f{ radius,  radius};
-  vertices[3].position = position + sf::Vector2f{-radius,  radius};
+  vertices[0].position = position + nb::Vector2f{-radius, -radius};
+  vertices[1].position = position + nb::Vector2f{ radius, -radius};
+  vertices[2].position = position + nb::Vector2f{ radius,  radius};
+  vertices[3].position = position + nb::Vector2f{-radius,  radius};
 }
 
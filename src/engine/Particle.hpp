@@ -1,30 +1,80 @@
 #pragma once
 
+#include <cmath>
+
 class Particle {
   public:
-    Particle(sf::Vector2f position, float mass = INITIAL_MASS, float radius = RADIUS, sf::Color color = {30, 30, 30});
+    Particle(nb::Vector2f position, float mass = INITIAL_MASS, float radius = RADIUS, nb::Color color = {30, 30, 30});
 
-    [[nodiscard]] const sf::Vector2f& getPosition() const;
-    [[nodiscard]] const sf::Vector2f& getVelocity() const;
+    [[nodiscard]] const nb::Vector2f& getPosition() const;
+    [[nodiscard]] const nb::Vector2f& getVelocity() const;
+    [[nodiscard]] const nb::Vector2f& getAcceleration() const;
+    [[nodiscard]] float getLastAcceleration() const; // Magnitude of the acceleration the last update applied
     [[nodiscard]] const float& getMass() const;
-    [[nodiscard]] const sf::VertexArray& getVertices() const;
+    [[nodiscard]] const float& getRadius() const;
+    [[nodiscard]] const nb::Vertex* getVertices() const; // Quad, 4 vertices
+
+    void setVelocity(nb::Vector2f v);
 
     void update(float dt);
-    void update(sf::Vector2f pos);
+    void update(nb::Vector2f pos);
+
+    template<float Softening = ZERO_DIVISION_PREVENT_VALUE>
+    void attractTo(const nb::Vector2f& attractorPos, const float& attractorMass);
 
-    void attractTo(const sf::Vector2f& attractorPos, const float& attractorMass);
+    // Potential per unit mass at distance d from a body of that mass, the one the force of attractTo derives from
+    template<float Softening = ZERO_DIVISION_PREVENT_VALUE>
+    [[nodiscard]] static float potential(float mass, float d);
+
+    // Absorbs the other particle conserving mass and momentum
+    void merge(const Particle& other);
 
   private:
     float mass;
     float radius;
-    sf::Vector2f position;
-    sf::Vector2f velocity;
-    sf::Vector2f acceleration;
-    sf::VertexArray vertices{sf::Quads, 4};
+    nb::Vector2f position;
+    nb::Vector2f velocity;
+    nb::Vector2f acceleration;
+    float lastAcceleration = 0.f;
+    nb::Vertex vertices[4]; // Inline so a particle is one flat block, without an allocation of its own
 
   private:
     void updatePosition(float dt);
-    void updatePosition(sf::Vector2f pos);
+    void updatePosition(nb::Vector2f pos);
     void updatePositionVertices();
+
+    static constexpr float cubeRoot(float x); // Of a positive constant, at compile time
 };
 
+
+constexpr float Particle::cubeRoot(float x) {
+  // Newton's method from above the root, it only decreases until the float runs out of precision
+  float r = x > 1.f ? x : 1.f;
+  for (float next = (2.f * r + x / (r * r)) / 3.f; next < r; next = (2.f * r + x / (r * r)) / 3.f) r = next;
+  return r;
+}
+
+
+template<float Softening>
+void Particle::attractTo(const nb::Vector2f& attractorPos, const float& attractorMass) {
+  nb::Vector2f v = attractorPos - position;
+  float magSq = v.x * v.x + v.y * v.y;
+  float mag = std::sqrt(magSq);
+
+  acceleration += attractorMass / (magSq * mag + Softening) * v;
+}
+
+template<float Softening>
+float Particle::potential(float mass, float d) {
+  if constexpr (Softening == 0.f) {
+    return -mass / d;
+  } else {
+    // Integral of m r / (r^3 + a^3) from d out, written with atan2 and log1p so it keeps its precision far away,
+    // where it tends to -m / d. Finite at d = 0, unlike -m / (d + softening) it matches the force in the core too.
+    constexpr float a = cubeRoot(Softening);
+    float x = (2.f * d - a) / (a * 1.73205081f);
+    float q = 3.f * a * d / ((d + a) * (d + a));
+
+    return -mass / a * (std::atan2(1.f, x) / 1.73205081f - std::log1p(-q) / 6.f);
+  }
+}
@@ -1,88 +1,814 @@
+#include <cassert>
+
 #include "ParticleSystem.hpp"
 #include "Spawner.hpp"
 
-ParticleSystem::ParticleSystem(const sf::Texture* texture) : texture(texture) {
-  Spawner::spiral(particles, center);
+static qt::Rectangle rectangle(const nb::FloatRect& r) {
+  return {r.left + r.width * 0.5f, r.top + r.height * 0.5f, r.width * 0.5f, r.height * 0.5f};
+}
+
+// Summed over every system that steps, the gauges are those of the last step
+static metrics::Counter& stepsDone = metrics::counter("nbody_steps_total", "Steps of every system");
+static metrics::Histogram& stepSeconds = metrics::histogram("nbody_step_seconds", "Wall time of a step");
+static metrics::Histogram* phaseSeconds[] = {
+  &metrics::histogram("nbody_phase_seconds", "Wall time of a phase of the step", "phase=\"tree\""),
+  &metrics::histogram("nbody_phase_seconds", "Wall time of a phase of the step", "phase=\"force\""),
+  &metrics::histogram("nbody_phase_seconds", "Wall time of a phase of the step", "phase=\"integrate\""),
+  &metrics::histogram("nbody_phase_seconds", "Wall time of a phase of the step", "phase=\"vertices\"")
+};
+static metrics::Counter& interactionsDone = metrics::counter("nbody_interactions_total", "Body-body and body-node interactions");
+static metrics::Gauge& stepInteractionsGauge = metrics::gauge("nbody_interactions_per_step", "Interactions of the last step");
+static metrics::Gauge& bodiesGauge = metrics::gauge("nbody_bodies", "Bodies of the last system stepped");
+static metrics::Gauge& farFieldGauge = metrics::gauge("nbody_far_field_bodies", "Outliers left out of the tree at the last build");
+static metrics::Gauge& treeNodesGauge = metrics::gauge("nbody_tree_nodes", "Nodes of the last tree");
+static metrics::Gauge& treeDepthGauge = metrics::gauge("nbody_tree_depth", "Depth of the last tree");
+static metrics::Histogram& criticalPathSeconds = metrics::histogram("nbody_critical_path_seconds", "Longest chain of dependent tasks of a step graph");
+static metrics::Gauge& utilizationGauge = metrics::gauge("nbody_pool_utilization", "Share of the step its pool's workers spent in jobs");
+
+// The opening criterion takes the width of a node as its size, so roots are square
+static nb::FloatRect square(nb::Vector2f min, nb::Vector2f max) {
+  float half = std::max(max.x - min.x, max.y - min.y) * 0.5f + 1.f; // Bodies on the edge stay inside after rounding
+  nb::Vector2f c = (min + max) * 0.5f;
+  return {c.x - half, c.y - half, half * 2.f, half * 2.f};
+}
+
+ParticleSystem::ParticleSystem(uint32_t count, uint32_t threads, bool pinned) {
+  if (threads == serialThreads) tp.startSerial();
+  else tp.start(threads ? threads : std::thread::hardware_concurrency(), pinned);
+
+  // Pinned workers touch their slice of the storage before the spawner fills it,
+  // so the pages land on the node of the worker that integrates those particles
+  if (tp.isPinned()) {
+    particles.reserve(count);
+    tp.firstTouch(particles.data(), count * sizeof(Particle));
+  }
 
-  qt = new qt::Node(initBoundary);
-  gpuCalc = new RuntimeOpenCL(particles);
+  Spawner::spiral(particles, center, count);
 
-  tp.start();
+  qt = new qt::Node(rectangle(root));
+  // Serial systems are small members of an ensemble, mostly cache resident already
+  if (HILBERT_REORDER && threads != serialThreads) ordering = new HilbertOrder(tp);
 }
 
 ParticleSystem::~ParticleSystem() {
   delete qt;
+  delete farField;
   delete gpuCalc;
+  delete domain;
+  delete autotuner;
+  delete ordering;
   tp.stop();
 }
 
+const Variant& ParticleSystem::getVariant() const {
+  return *variant;
+}
+
+const Diagnostics& ParticleSystem::getDiagnostics() const {
+  return diagnostics;
+}
+
+const ParticleSystem::StepTimes& ParticleSystem::getStepTimes() const {
+  return stepTimes;
+}
+
+uint64_t ParticleSystem::getInteractions() const {
+  return stepInteractions;
+}
+
+const char* ParticleSystem::getEngineName() const {
+  if (useGpu) return "OpenCL direct sum";
+  if (domain) return "distributed tree";
+  if (cachingInteractions) return "tree, cached lists";
+  if (directSum) return "CPU direct sum";
+  return tp.isPinned() ? "tree, pinned build" : "tree";
+}
+
+const ThreadPool& ParticleSystem::getThreadPool() const {
+  return tp;
+}
+
+void ParticleSystem::countTreeNodes(uint32_t& nodes, uint32_t& depth) const {
+  nodes = depth = 0;
+  qt->countNodes(nodes, depth);
+  if (farField) farField->countNodes(nodes, depth);
+}
+
+size_t ParticleSystem::getFarFieldCount() const {
+  return farField ? farBodies.size() : 0;
+}
+
+void ParticleSystem::setVariant(size_t index) {
+  variant = &Variants::table[index % Variants::count];
+  interactions.invalidate();
+}
+
+void ParticleSystem::nextVariant() {
+  setVariant(variant - Variants::table + 1);
+}
+
 void ParticleSystem::toggleGpuMode() {
+  // Ranks only run the tree code
+  if (domain) return;
+
+  // The OpenCL runtime is created on first use, headless runs may have no GPU at all
+  if (!gpuCalc) {
+    gpuCalc = new RuntimeOpenCL(particles);
+    hostAhead = false;
+  }
+
+  // The engine that ran last hands its bodies over, the other one picks them up before its next step
+  if (useGpu) syncHost();
   useGpu = !useGpu;
+  interactions.invalidate(); // The GPU path rebuilds or skips the tree under the lists
+}
+
+void ParticleSystem::setEngine(Engine engine) {
+  if (domain) return;
+
+  if ((engine == Engine::OpenCL) != useGpu) toggleGpuMode();
+  if ((engine == Engine::CachedTree) != cachingInteractions) toggleInteractionCache();
+  directSum = engine == Engine::Direct;
+}
+
+Engine ParticleSystem::getEngine() const {
+  if (useGpu) return Engine::OpenCL;
+  if (cachingInteractions) return Engine::CachedTree;
+  return directSum ? Engine::Direct : Engine::Tree;
+}
+
+void ParticleSystem::setAutotune(bool enabled) {
+  delete autotuner;
+  autotuner = enabled ? new Autotuner() : nullptr;
+}
+
+const Autotuner* ParticleSystem::getAutotuner() const {
+  return autotuner;
+}
+
+void ParticleSystem::restore(const std::vector<Particle>& bodies) {
+  particles = bodies;
+  hostAhead = true;
+  deviceAhead = false;
+  interactions.invalidate();
+}
+
+void ParticleSystem::addParticles(const std::vector<Particle>& bodies) {
+  beginEdit();
+  reserveParticles(particles.size() + bodies.size());
+  particles.insert(particles.end(), bodies.begin(), bodies.end());
+  endEdit();
+}
+
+void ParticleSystem::removeParticle(size_t index) {
+  assert(index < particles.size());
+  if (index >= particles.size()) return;
+
+  beginEdit();
+  particles[index] = particles.back();
+  particles.pop_back();
+  endEdit();
+}
+
+size_t ParticleSystem::removeEscaped(float distance) {
+  beginEdit();
+  const size_t before = particles.size();
+  const float distanceSq = distance * distance;
+
+  // The last body moves into every hole, it is checked in its new place before moving on
+  for (size_t i = 0; i < particles.size();) {
+    nb::Vector2f d = particles[i].getPosition() - center;
+    if (d.x * d.x + d.y * d.y <= distanceSq) {
+      i++;
+      continue;
+    }
+    particles[i] = particles.back();
+    particles.pop_back();
+  }
+
+  if (particles.size() != before) endEdit();
+  return before - particles.size();
+}
+
+size_t ParticleSystem::getParticleCount() const {
+  return particles.size();
+}
+
+const std::vector<Particle>& ParticleSystem::getParticles() {
+  syncHost();
+  return particles;
+}
+
+void ParticleSystem::reserveParticles(size_t count) {
+  if (count <= particles.capacity()) return;
+
+  const size_t capacity = std::max(count, particles.capacity() * 2);
+  if (!tp.isPinned()) {
+    particles.reserve(capacity);
+    return;
+  }
+
+  // reserve would place the new pages wherever the copy touches them first
+  std::vector<Particle> grown;
+  grown.reserve(capacity);
+  tp.firstTouch(grown.data(), capacity * sizeof(Particle));
+  grown.insert(grown.end(), particles.begin(), particles.end());
+  particles.swap(grown);
+}
+
+void ParticleSystem::beginEdit() {
+  // Edits go to the state of record, the device picks them up with its next upload
+  syncHost();
+}
+
+void ParticleSystem::endEdit() {
+  hostAhead = true;
+  interactions.invalidate();
+}
+
+void ParticleSystem::toggleMerging() {
+  merging = !merging;
+  stepTimeSum = 0.f;
+  mergeSteps = 0;
+}
+
+void ParticleSystem::toggleInteractionCache() {
+  // Ranks rebuild their tree around the migrated bodies every step
+  if (domain) return;
+
+  cachingInteractions = !cachingInteractions;
+  interactions.invalidate();
+  listUpkeepSum = listSolveSum = 0.f;
+  listSteps = listBuilds = 0;
+}
+
+void ParticleSystem::toggleReordering() {
+  if (ordering) {
+    delete ordering;
+    ordering = nullptr;
+  } else {
+    ordering = new HilbertOrder(tp);
+  }
+}
+
+const HilbertOrder* ParticleSystem::getOrdering() const {
+  return ordering;
+}
+
+void ParticleSystem::setDiagnosticsInterval(uint32_t interval) {
+  diagnosticsInterval = interval;
+  hasInitialDiagnostics = false;
+
+  if (interval && !diagnosticsLog.is_open()) {
+    diagnosticsLog.open(DIAGNOSTICS_FILE);
+    diagnosticsLog << "step,kinetic,potential,energy,drift,momentum_x,momentum_y,angular_momentum\n";
+  }
+}
+
+void ParticleSystem::distribute(Domain* d) {
+  delete domain;
+  domain = d;
+  domain->scatter(particles);
 }
 
 void ParticleSystem::update(float dt) {
+  if (autotuner && autotuner->isStale(particles)) autotuner->tune(*this);
+  step(dt);
+}
+
+void ParticleSystem::step(float dt) {
+  TRACE_SCOPE("update");
+  stepClock.restart();
+
+  bool measure = diagnosticsInterval && steps % diagnosticsInterval == 0;
+  nb::Clock phase;
+
   if (useGpu) {
+    // The GPU path needs no tree except to measure or to cull
+    if (measure || culling) {
+      syncHost();
+      updateQuadTree();
+    }
+    stepTimes.tree = phase.getElapsedTime().asSeconds();
+    if (measure) updateDiagnostics();
+    phase.restart();
     updateAttractionGpu(dt);
-    updateVertices();
+    stepTimes.force = phase.restart().asSeconds();
+    stepTimes.integrate = 0.f;
+    stepTimes.vertices = 0.f;
   } else {
-    updateQuadTree();
-    updateAttraction();
-    updateParticles(dt);
+    // Sorted before anything points into the store. Ranks reorder their bodies when they migrate them anyway.
+    if (ordering && !domain) {
+      float lastStep = stepTimes.tree + stepTimes.force + stepTimes.integrate + stepTimes.vertices;
+      if (ordering->update(particles, root, lastStep, tp)) interactions.invalidate();
+    }
+
+    // Direct sums need the tree only to measure or to cull, as the GPU path
+    hostAhead = true;
+    if (cachingInteractions) updateInteractionLists();
+    else if (!directSum || measure || culling) updateQuadTree();
+    stepTimes.tree = phase.getElapsedTime().asSeconds();
+    if (measure) updateDiagnostics();
+    phase.restart();
+    if (ordering) ordering->beginForce();
+
+    // Ranks hold pointers to remote bodies in their tree, the graph only knows the chunks of the local store
+    graphVertices = false;
+    if (TASK_GRAPH && !cachingInteractions && !directSum && !domain) {
+      updateGraph(dt);
+      if (ordering) ordering->endForce(stepTimes.force);
+    } else {
+      if (cachingInteractions) updateAttractionCached();
+      else if (directSum) updateAttractionDirect();
+      else updateAttraction();
+      stepTimes.force = phase.restart().asSeconds();
+      if (ordering) ordering->endForce(stepTimes.force);
+      updateParticles(dt);
+      stepTimes.integrate = phase.getElapsedTime().asSeconds();
+    }
+
+    if (merging) mergeCloseEncounters();
+    phase.restart();
+  }
+
+  if (graphVertices) {
+    stepTimes.vertices = 0.f;
+  } else if (!useGpu || !gpuVertices) {
     updateVertices();
+    stepTimes.vertices = phase.getElapsedTime().asSeconds();
   }
+
+  if (merging) reportMerging();
+  steps++;
+  publishMetrics();
 }
 
-void ParticleSystem::drawGrid(sf::RenderTarget& target, const uint32_t& limit) const {
-  qt->show(target, limit);
+void ParticleSystem::publishMetrics() {
+  float stepTime = stepClock.getElapsedTime().asSeconds();
+  stepsDone.add();
+  stepSeconds.observe(stepTime);
+  phaseSeconds[0]->observe(stepTimes.tree);
+  phaseSeconds[1]->observe(stepTimes.force);
+  phaseSeconds[2]->observe(stepTimes.integrate);
+  phaseSeconds[3]->observe(stepTimes.vertices);
+
+  interactionsDone.add(stepInteractions);
+  stepInteractionsGauge.set(stepInteractions);
+  bodiesGauge.set(particles.size());
+  farFieldGauge.set(getFarFieldCount());
+
+  uint64_t busy = tp.busyTime();
+  if (stepTime > 0.f) utilizationGauge.set((busy - lastBusyTime) * 1e-9 / (stepTime * tp.size()));
+  lastBusyTime = busy;
+
+  // Kept by the moments pass, no walk
+  uint32_t nodes, depth;
+  countTreeNodes(nodes, depth);
+  treeNodesGauge.set(nodes);
+  treeDepthGauge.set(depth);
 }
 
-void ParticleSystem::draw(sf::RenderTarget& target, sf::RenderStates states) const {
-  states.transform *= getTransform();
-  states.texture = texture;
-  states.blendMode = sf::BlendAdd;
+const nb::Vertex* ParticleSystem::getVertices() const {
+  return useGpu && gpuVertices ? gpuCalc->getVertices() : vertices.data();
+}
 
-  target.draw(vertices, states);
+size_t ParticleSystem::getVertexCount() const {
+  return useGpu && gpuVertices ? gpuCalc->getVertexCount() : vertices.size();
 }
 
-void ParticleSystem::updateQuadTree() {
-  delete qt; qt = new qt::Node(initBoundary);
-  for (Particle& particle : particles)
-    qt->insert(&particle);
+void ParticleSystem::collectGrid(uint32_t limit, std::vector<nb::FloatRect>& rects) const {
+  qt->collectBoundaries(limit, rects);
 }
 
-void ParticleSystem::updateAttraction() {
-  int slice = particles.size() / tp.size();
-  for (int i = 0; i < tp.size(); i++) {
-    int begin = i * slice;
-    int end = begin + slice;
+void ParticleSystem::updateQuadTree() {
+  TRACE_SCOPE("updateQuadTree");
+  if (domain) {
+    updateQuadTreeDistributed();
+    return;
+  }
 
-    tp.queueJob([this, begin, end] {updateAttractionThreaded(begin, end);});
+  updateBounds();
+  if (tp.isPinned()) {
+    updateQuadTreeParallel();
+  } else {
+    delete qt; qt = new qt::Node(rectangle(root));
+    variant->insert(qt, particles);
+    updateMoments();
   }
+  updateFarField();
+}
+
+void ParticleSystem::updateQuadTreeParallel() {
+  delete qt;
+  tp.resetArenas();
+
+  qt = new qt::Node(rectangle(root));
+  subtrees.clear();
+  qt->split(TREE_SPLIT_LEVELS, subtrees);
+
+  // 1. Sort the particles into the subtrees, every slice keeps its own buckets
+  buckets.resize(tp.size());
+  tp.parallelFor(particles.size(), [this](size_t begin, size_t end, uint32_t slice) {
+    std::vector<std::vector<const Particle*>>& own = buckets[slice];
+    own.resize(subtrees.size());
+    for (std::vector<const Particle*>& b : own) b.clear();
+
+    for (size_t i = begin; i < end; i++) {
+      int index = qt->ownerIndex(&particles[i], TREE_SPLIT_LEVELS);
+      if (index >= 0) own[index].push_back(&particles[i]);
+    }
+  });
+
+  // 2. Build every subtree and its moments on one worker, its nodes come from that worker's arena
+  for (size_t j = 0; j < subtrees.size(); j++)
+    tp.queueJob(j % tp.size(), [this, j] {
+      Arena::setCurrent(&tp.arena(j % tp.size()));
+      for (const std::vector<std::vector<const Particle*>>& own : buckets)
+        variant->insertRange(subtrees[j], own[j].data(), own[j].data() + own[j].size());
+      subtrees[j]->refit();
+      Arena::setCurrent(nullptr);
+    });
   tp.waitForCompletion();
+
+  // 3. Levels above the subtrees
+  qt->gatherGravity(TREE_SPLIT_LEVELS);
+}
+
+void ParticleSystem::updateQuadTreeDistributed() {
+  qt::Rectangle boundary = domain->decompose(particles);
+
+  delete qt; qt = new qt::Node(boundary);
+  variant->insert(qt, particles);
+  updateMoments();
+
+  // The essential tree is taken before the remote moments are added, so only local bodies are sent
+  domain->exchangeEssentialTree(qt, *variant, remoteParticles);
+  variant->insert(qt, remoteParticles);
+  updateMoments();
+}
+
+void ParticleSystem::updateBounds() {
+  TRACE_SCOPE("updateBounds");
+  if (particles.empty()) return;
+
+  // 1. Extent of every body, reduced per slice
+  extents.resize(tp.size());
+  tp.parallelFor(particles.size(), [this](size_t begin, size_t end, uint32_t slice) {
+    Extent e{{INFINITY, INFINITY}, {-INFINITY, -INFINITY}};
+    for (size_t i = begin; i < end; i++) {
+      const nb::Vector2f& pos = particles[i].getPosition();
+      e.min = {std::min(e.min.x, pos.x), std::min(e.min.y, pos.y)};
+      e.max = {std::max(e.max.x, pos.x), std::max(e.max.y, pos.y)};
+    }
+    extents[slice] = e;
+  });
+
+  Extent all = extents.front();
+  for (const Extent& e : extents) {
+    all.min = {std::min(all.min.x, e.min.x), std::min(all.min.y, e.min.y)};
+    all.max = {std::max(all.max.x, e.max.x), std::max(all.max.y, e.max.y)};
+  }
+
+  // 2. Quantiles of a strided sample. Bodies further past them than the margin are outliers, a few escapers
+  // would otherwise stretch the root and leave the bodies that matter deep down in a mostly empty tree.
+  const size_t stride = particles.size() / FAR_FIELD_SAMPLES + 1;
+  sampleX.clear();
+  sampleY.clear();
+  for (size_t i = 0; i < particles.size(); i += stride) {
+    sampleX.push_back(particles[i].getPosition().x);
+    sampleY.push_back(particles[i].getPosition().y);
+  }
+
+  const size_t low = sampleX.size() * FAR_FIELD_QUANTILE;
+  const size_t high = sampleX.size() - 1 - low;
+  std::nth_element(sampleX.begin(), sampleX.begin() + low, sampleX.end());
+  std::nth_element(sampleY.begin(), sampleY.begin() + low, sampleY.end());
+  nb::Vector2f lowQuantile{sampleX[low], sampleY[low]};
+  std::nth_element(sampleX.begin(), sampleX.begin() + high, sampleX.end());
+  std::nth_element(sampleY.begin(), sampleY.begin() + high, sampleY.end());
+  nb::Vector2f highQuantile{sampleX[high], sampleY[high]};
+
+  const float margin = std::max(highQuantile.x - lowQuantile.x, highQuantile.y - lowQuantile.y) * FAR_FIELD_MARGIN;
+  Extent core{
+    {std::max(all.min.x, lowQuantile.x - margin), std::max(all.min.y, lowQuantile.y - margin)},
+    {std::min(all.max.x, highQuantile.x + margin), std::min(all.max.y, highQuantile.y + margin)}
+  };
+
+  root = square(core.min, core.max);
+  farRoot = square(all.min, all.max);
+  hasOutliers = core.min != all.min || core.max != all.max;
+}
+
+void ParticleSystem::updateFarField() {
+  delete farField;
+  farField = nullptr;
+  if (!hasOutliers) return;
+
+  // Bodies the tree left out, the square root may have taken some of the outliers in after all
+  farSlices.resize(tp.size());
+  tp.parallelFor(particles.size(), [this](size_t begin, size_t end, uint32_t slice) {
+    std::vector<const Particle*>& own = farSlices[slice];
+    own.clear();
+    for (size_t i = begin; i < end; i++)
+      if (!qt->contains(&particles[i])) own.push_back(&particles[i]);
+  });
+
+  farBodies.clear();
+  for (const std::vector<const Particle*>& own : farSlices)
+    farBodies.insert(farBodies.end(), own.begin(), own.end());
+  if (farBodies.empty()) return;
+
+  farField = new qt::Node(rectangle(farRoot));
+  variant->insertRange(farField, farBodies.data(), farBodies.data() + farBodies.size());
+  farField->refit();
+}
+
+uint64_t ParticleSystem::solveFarField(std::vector<Particle>& bodies) {
+  if (!farField) return 0;
+
+  sliceInteractions.assign(tp.size(), 0);
+  tp.parallelFor(bodies.size(), [this, &bodies](size_t begin, size_t end, uint32_t slice) {
+    sliceInteractions[slice] = variant->solveAttraction(farField, bodies.data() + begin, bodies.data() + end);
+  });
+
+  uint64_t total = 0;
+  for (uint64_t n : sliceInteractions) total += n;
+  return total;
+}
+
+void ParticleSystem::updateMoments() {
+  TRACE_SCOPE("updateMoments");
+  // Subtrees below the split levels in parallel, then the few nodes above them
+  levelNodes.clear();
+  qt->collectLevel(TREE_SPLIT_LEVELS, levelNodes);
+
+  tp.parallelFor(levelNodes.size(), [this](size_t begin, size_t end, uint32_t) {
+    for (size_t i = begin; i < end; i++)
+      levelNodes[i]->refit();
+  });
+
+  qt->gatherGravity(TREE_SPLIT_LEVELS);
 }
 
-void ParticleSystem::updateAttractionThreaded(int begin, int end) {
-  for (int i = begin; i < end; i++)
-    qt->solveAttraction(&particles[i]);
+void ParticleSystem::updateAttraction() {
+  TRACE_SCOPE("updateAttraction");
+  sliceInteractions.assign(tp.size(), 0);
+  tp.parallelFor(particles.size(), [this](size_t begin, size_t end, uint32_t slice) {
+    sliceInteractions[slice] = updateAttractionThreaded(begin, end);
+  });
+
+  stepInteractions = 0;
+  for (uint64_t n : sliceInteractions) stepInteractions += n;
+}
+
+uint64_t ParticleSystem::updateAttractionThreaded(int begin, int end) {
+  uint64_t interactions = variant->solveAttraction(qt, particles.data() + begin, particles.data() + end);
+
+  // The outliers are few and far away, their tree opens little
+  if (farField) interactions += variant->solveAttraction(farField, particles.data() + begin, particles.data() + end);
+  return interactions;
+}
+
+void ParticleSystem::updateAttractionDirect() {
+  TRACE_SCOPE("updateAttractionDirect");
+  tp.parallelFor(particles.size(), [this](size_t begin, size_t end, uint32_t) {
+    variant->solveDirect(particles, particles.data() + begin, particles.data() + end);
+  });
+  stepInteractions = particles.empty() ? 0 : particles.size() * (particles.size() - 1);
 }
 
 void ParticleSystem::updateAttractionGpu(float dt) {
-  gpuCalc->run(dt);
-  const cl_float4* clParticlesPtr = gpuCalc->getComputedParticlesPtr();
+  TRACE_SCOPE("updateAttractionGpu");
+  stepInteractions = particles.empty() ? 0 : particles.size() * (particles.size() - 1);
+
+  // Without culling the host has nothing to do with the bodies, the kernel writes the quads SFML draws
+  syncDevice();
 
-  for (int i = 0; i < particles.size(); i++)
-    particles[i].update({clParticlesPtr[i].x, clParticlesPtr[i].y});
+  gpuVertices = !culling;
+  if (gpuVertices) {
+    gpuCalc->runVertices(dt, variant->softening);
+    deviceAhead = true;
+    return;
+  }
+
+  gpuCalc->run(dt, variant->softening, particles);
+}
+
+void ParticleSystem::syncHost() {
+  if (!deviceAhead) return;
+
+  gpuCalc->download(particles);
+  deviceAhead = false;
+}
+
+void ParticleSystem::syncDevice() {
+  if (!hostAhead) return;
+
+  gpuCalc->upload(particles);
+  hostAhead = false;
+}
+
+void ParticleSystem::updateInteractionLists() {
+  TRACE_SCOPE("updateInteractionLists");
+  nb::Clock clock;
+
+  bool valid = interactions.isBuilt();
+  if (valid) {
+    updateMoments();
+    if (farField) farField->refit();
+    valid = interactions.refresh(qt, particles, *variant, tp);
+  }
+
+  if (!valid) {
+    updateQuadTree();
+    interactions.build(qt, particles, *variant, tp);
+    listBuilds++;
+  }
+
+  listUpkeepSum += clock.getElapsedTime().asSeconds();
+}
+
+void ParticleSystem::updateAttractionCached() {
+  TRACE_SCOPE("updateAttractionCached");
+  bool report = ++listSteps % INTERACTION_LIST_REPORT_INTERVAL == 0;
+
+  // Same tree walked the usual way, on copies so the real accelerations come from the lists only
+  float walkTime = 0.f;
+  if (report) {
+    nb::Clock clock;
+    reference = particles;
+    tp.parallelFor(reference.size(), [this](size_t begin, size_t end, uint32_t) {
+      variant->solveAttraction(qt, reference.data() + begin, reference.data() + end);
+    });
+    solveFarField(reference);
+    walkTime = clock.getElapsedTime().asSeconds();
+  }
+
+  nb::Clock clock;
+  stepInteractions = interactions.solve(qt, particles, *variant, tp);
+  stepInteractions += solveFarField(particles);
+  listSolveSum += clock.getElapsedTime().asSeconds();
+
+  if (report) reportInteractions(walkTime);
+}
+
+void ParticleSystem::reportInteractions(float walkTime) {
+  // Both against the direct sum on a sample of the bodies, weighted by the force so nearly balanced bodies do not dominate
+  const size_t stride = particles.size() / INTERACTION_LIST_SAMPLES + 1;
+  double walkError = 0.0, cachedError = 0.0, exactSum = 0.0;
+
+  for (size_t i = 0; i < particles.size(); i += stride) {
+    nb::Vector2f exact;
+    for (const Particle& p : particles) {
+      nb::Vector2f v = p.getPosition() - particles[i].getPosition();
+      float magSq = v.x * v.x + v.y * v.y;
+      exact += p.getMass() / (magSq * std::sqrt(magSq) + variant->softening) * v;
+    }
+
+    nb::Vector2f dw = reference[i].getAcceleration() - exact;
+    nb::Vector2f dc = particles[i].getAcceleration() - exact;
+    walkError += std::sqrt(dw.x * dw.x + dw.y * dw.y);
+    cachedError += std::sqrt(dc.x * dc.x + dc.y * dc.y);
+    exactSum += std::sqrt(exact.x * exact.x + exact.y * exact.y);
+  }
+
+  printf(
+    "Lists: walk %.3f ms, cached %.3f ms + upkeep %.3f ms per step, %u builds, %u groups rewalked, error walk %.3e cached %.3e\n",
+    walkTime * 1000.f, listSolveSum / INTERACTION_LIST_REPORT_INTERVAL * 1000.f, listUpkeepSum / INTERACTION_LIST_REPORT_INTERVAL * 1000.f,
+    listBuilds, interactions.getRewalked(), walkError / exactSum, cachedError / exactSum
+  );
+
+  listUpkeepSum = listSolveSum = 0.f;
+  listBuilds = 0;
+}
+
+void ParticleSystem::updateGraph(float dt) {
+  TRACE_SCOPE("updateGraph");
+  const size_t n = particles.size();
+  const size_t chunkSize = std::max<size_t>(1, (n + tp.size() * TASK_GRAPH_CHUNKS_PER_WORKER - 1) / (tp.size() * TASK_GRAPH_CHUNKS_PER_WORKER));
+  const uint32_t chunks = (n + chunkSize - 1) / chunkSize;
+
+  // Quads straight from the integration, unless merging changes the bodies after it or culling draws from the tree
+  graphVertices = !culling && !merging;
+  if (graphVertices && vertices.size() != n * 4)
+    vertices.resize(n * 4);
+
+  // 1. Where every chunk lies and how far from its bodies another body may still read their positions
+  graphBounds.resize(chunks);
+  tp.parallelFor(chunks, [&](size_t begin, size_t end, uint32_t) {
+    for (size_t k = begin; k < end; k++) {
+      Extent& e = graphBounds[k];
+      e.min = e.max = particles[k * chunkSize].getPosition();
+      for (size_t i = k * chunkSize; i < std::min(n, (k + 1) * chunkSize); i++) {
+        const nb::Vector2f& pos = particles[i].getPosition();
+        e.min = {std::min(e.min.x, pos.x), std::min(e.min.y, pos.y)};
+        e.max = {std::max(e.max.x, pos.x), std::max(e.max.y, pos.y)};
+      }
+    }
+  });
+
+  graphLeaves.clear();
+  qt->collectLeaves(graphLeaves);
+  if (farField) farField->collectLeaves(graphLeaves);
+
+  graphReach.assign(tp.size() * chunks, 0.f);
+  tp.parallelFor(graphLeaves.size(), [&](size_t begin, size_t end, uint32_t slice) {
+    float* reach = &graphReach[slice * chunks];
+    for (size_t l = begin; l < end; l++) {
+      float distance = graphLeaves[l]->readDistance(variant->reach);
+      for (const Particle* p : graphLeaves[l]->bodies()) {
+        size_t k = (p - particles.data()) / chunkSize;
+        reach[k] = std::max(reach[k], distance);
+      }
+    }
+  });
+  for (uint32_t s = 1; s < static_cast<uint32_t>(tp.size()); s++)
+    for (uint32_t k = 0; k < chunks; k++)
+      graphReach[k] = std::max(graphReach[k], graphReach[s * chunks + k]);
+
+  // 2. Forces of every chunk, then its integration and quads once no force pass can read its bodies any more
+  graph.clear();
+  graphInteractions.assign(chunks, 0);
+  auto worker = [&](uint32_t k) { return static_cast<int>(k * static_cast<uint64_t>(tp.size()) / chunks); };
+
+  for (uint32_t k = 0; k < chunks; k++)
+    graph.add([this, k, chunkSize, n] {
+      graphInteractions[k] = updateAttractionThreaded(k * chunkSize, std::min(n, (k + 1) * chunkSize));
+    }, worker(k));
+
+  for (uint32_t k = 0; k < chunks; k++) {
+    uint32_t task = graph.add([this, k, chunkSize, n, dt] {
+      size_t end = std::min(n, (k + 1) * chunkSize);
+      for (size_t i = k * chunkSize; i < end; i++)
+        particles[i].update(dt);
+      if (graphVertices) copyVertices(k * chunkSize, end);
+    }, worker(k));
+
+    const Extent& own = graphBounds[k];
+    for (uint32_t c = 0; c < chunks; c++) {
+      const Extent& other = graphBounds[c];
+      float dx = std::max({0.f, own.min.x - other.max.x, other.min.x - own.max.x});
+      float dy = std::max({0.f, own.min.y - other.max.y, other.min.y - own.max.y});
+      if (dx * dx + dy * dy <= graphReach[k] * graphReach[k]) graph.depend(task, c);
+    }
+  }
+
+  graph.run(tp);
+
+  stepInteractions = 0;
+  for (uint64_t i : graphInteractions) stepInteractions += i;
+
+  // Forces end with the last force task, whatever integration overlapped them
+  stepTimes.force = 0.f;
+  for (uint32_t k = 0; k < chunks; k++) stepTimes.force = std::max(stepTimes.force, graph.finishedAt(k));
+  stepTimes.integrate = graph.wall() - stepTimes.force;
+  reportGraph();
+}
+
+void ParticleSystem::reportGraph() {
+  float path = graph.criticalPath();
+  criticalPathSeconds.observe(path);
+
+  graphWallSum += graph.wall();
+  graphWorkSum += graph.work();
+  graphPathSum += path;
+  if (++graphSteps < TASK_GRAPH_REPORT_INTERVAL) return;
+
+  printf(
+    "Task graph: %zu tasks, %zu edges, wall %.3f ms, critical path %.3f ms, work %.3f ms per step (parallelism %.1f on %d workers)\n",
+    graph.size(), graph.edges(), graphWallSum / graphSteps * 1000.f, graphPathSum / graphSteps * 1000.f,
+    graphWorkSum / graphSteps * 1000.f, graphWorkSum / graphPathSum, tp.size()
+  );
+  graphWallSum = graphWorkSum = graphPathSum = 0.f;
+  graphSteps = 0;
 }
 
 void ParticleSystem::updateParticles(float dt) {
-  for (Particle& p : particles)
-    p.update(dt);
+  TRACE_SCOPE("updateParticles");
+  tp.parallelFor(particles.size(), [this, dt](size_t begin, size_t end, uint32_t) {
+    for (size_t i = begin; i < end; i++)
+      particles[i].update(dt);
+  });
 }
 
 void ParticleSystem::updateVertices() {
-  for (int i = 0; i < particles.size(); i++) {
-    const sf::VertexArray& va = particles[i].getVertices();
-    int ii = i << 2;
+  TRACE_SCOPE("updateVertices");
+  if (culling) {
+    updateVisible();
+    return;
+  }
+
+  // Merging and migration change the body count
+  if (vertices.size() != particles.size() * 4)
+    vertices.resize(particles.size() * 4);
+
+  copyVertices(0, particles.size());
+}
+
+void ParticleSystem::copyVertices(size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    const nb::Vertex* va = particles[i].getVertices();
+    size_t ii = i << 2;
     vertices[ii + 0] = va[0];
     vertices[ii + 1] = va[1];
     vertices[ii + 2] = va[2];
@@ -90,3 +816,146 @@ void ParticleSystem::updateVertices() {
   }
 }
 
+void ParticleSystem::updateVisible() {
+  static const nb::Color bodyColor(30, 30, 30);
+
+  qt::Rectangle view(
+    viewport.left + viewport.width * 0.5f, viewport.top + viewport.height * 0.5f,
+    viewport.width * 0.5f, viewport.height * 0.5f
+  );
+
+  vertices.clear();
+  splats.clear();
+
+  auto body = [this](const Particle* p) {
+    const nb::Vertex* va = p->getVertices();
+    vertices.insert(vertices.end(), va, va + 4);
+    splats.push_back({p->getPosition(), p->getMass()});
+  };
+
+  // Sub-pixel nodes become one quad as bright as the bodies they hold (up to saturation)
+  auto aggregate = [this](const qt::Node::Gravity& g, float width) {
+    float r = std::max(width, pixelSize) * 0.5f;
+    uint8_t c = static_cast<uint8_t>(std::min(bodyColor.r * g.mass, 255.f));
+    nb::Color color(c, c, c);
+    vertices.push_back({g.center + nb::Vector2f{-r, -r}, color, {0.f, 0.f}});
+    vertices.push_back({g.center + nb::Vector2f{ r, -r}, color, {CIRCLE_TEXTURE_SIZE, 0.f}});
+    vertices.push_back({g.center + nb::Vector2f{ r,  r}, color, {CIRCLE_TEXTURE_SIZE, CIRCLE_TEXTURE_SIZE}});
+    vertices.push_back({g.center + nb::Vector2f{-r,  r}, color, {0.f, CIRCLE_TEXTURE_SIZE}});
+    splats.push_back({g.center, g.mass});
+  };
+
+  qt->collectVisible(view, pixelSize * LOD_PIXEL_THRESHOLD, body, aggregate);
+  if (farField) farField->collectVisible(view, pixelSize * LOD_PIXEL_THRESHOLD, body, aggregate);
+}
+
+void ParticleSystem::mergeCloseEncounters() {
+  TRACE_SCOPE("mergeCloseEncounters");
+  spatialHash.findPairs(particles, MERGE_RADIUS, tp, closePairs);
+  if (closePairs.empty()) return;
+
+  // Pairs are sorted, so chains (a-b, b-c) resolve the same way every time: each particle merges at most once per step
+  enum : uint8_t { Untouched, Merged, Absorbed };
+  mergeState.assign(particles.size(), Untouched);
+  for (const auto& [i, j] : closePairs) {
+    if (mergeState[i] != Untouched || mergeState[j] != Untouched) continue;
+    particles[i].merge(particles[j]);
+    mergeState[i] = Merged;
+    mergeState[j] = Absorbed;
+  }
+
+  // Compact in place keeping the order
+  size_t w = 0;
+  for (size_t r = 0; r < particles.size(); r++)
+    if (mergeState[r] != Absorbed) {
+      if (w != r) particles[w] = particles[r];
+      w++;
+    }
+  particles.erase(particles.begin() + w, particles.end());
+}
+
+void ParticleSystem::reportMerging() {
+  stepTimeSum += stepClock.getElapsedTime().asSeconds();
+  mergeSteps++;
+
+  if (mergeSteps % MERGE_REPORT_INTERVAL == 0) {
+    printf("Step %u, N: %zu, step time: %.3f ms\n", mergeSteps, particles.size(), stepTimeSum / MERGE_REPORT_INTERVAL * 1000.f);
+    stepTimeSum = 0.f;
+  }
+}
+
+void ParticleSystem::updateDiagnostics() {
+  TRACE_SCOPE("updateDiagnostics");
+  diagnostics = Diagnostics::measure(particles, qt, farField, *variant, tp);
+  diagnostics.step = steps;
+
+  if (!hasInitialDiagnostics) {
+    initialDiagnostics = diagnostics;
+    hasInitialDiagnostics = true;
+  }
+
+  double drift = (diagnostics.energy() - initialDiagnostics.energy()) / std::abs(initialDiagnostics.energy());
+
+  printf(
+    "Step %u, E: %.6g (drift %+.3e), K: %.6g, U: %.6g, P: (%.3g, %.3g), L: %.6g\n",
+    diagnostics.step, diagnostics.energy(), drift, diagnostics.kinetic, diagnostics.potential,
+    diagnostics.momentum.x, diagnostics.momentum.y, diagnostics.angularMomentum
+  );
+
+  diagnosticsLog
+    << diagnostics.step << ',' << diagnostics.kinetic << ',' << diagnostics.potential << ','
+    << diagnostics.energy() << ',' << drift << ',' << diagnostics.momentum.x << ','
+    << diagnostics.momentum.y << ',' << diagnostics.angularMomentum << '\n';
+}
+
+void ParticleSystem::setCamera(const nb::FloatRect& v, float size) {
+  viewport = v;
+  pixelSize = size;
+}
+
+void ParticleSystem::toggleCulling() {
+  culling = !culling;
+}
+
+void ParticleSystem::accumulateDensity(DensityMap& map) {
+  map.setView(viewport);
+  syncHost();
+
+  if (culling) map.accumulate(splats, tp);
+  else map.accumulate(particles, tp);
+}
+
+std::vector<double> ParticleSystem::measureBandwidth(uint32_t passes) {
+  // Every worker streams over its own slice, the bytes and seconds are summed per NUMA node
+  std::vector<double> seconds(tp.size(), 0.0);
+  std::vector<size_t> bytes(tp.size(), 0);
+  std::vector<float> sinks(tp.size(), 0.f);
+
+  tp.parallelFor(particles.size(), [&](size_t begin, size_t end, uint32_t slice) {
+    nb::Clock clock;
+    float sum = 0.f;
+    for (uint32_t pass = 0; pass < passes; pass++)
+      for (size_t i = begin; i < end; i++)
+        sum += particles[i].getPosition().x + particles[i].getVelocity().y;
+    seconds[slice] = clock.getElapsedTime().asSeconds();
+    bytes[slice] = (end - begin) * sizeof(Particle) * passes;
+    sinks[slice] = sum;
+  });
+
+  std::vector<double> nodeBytes, nodeSeconds;
+  for (int w = 0; w < tp.size(); w++) {
+    uint32_t node = tp.nodeOf(w);
+    if (node >= nodeBytes.size()) {
+      nodeBytes.resize(node + 1, 0.0);
+      nodeSeconds.resize(node + 1, 0.0);
+    }
+    nodeBytes[node] += bytes[w];
+    nodeSeconds[node] = std::max(nodeSeconds[node], seconds[w]);
+  }
+
+  std::vector<double> bandwidth(nodeBytes.size(), 0.0);
+  for (size_t n = 0; n < bandwidth.size(); n++)
+    if (nodeSeconds[n] > 0.0) bandwidth[n] = nodeBytes[n] / nodeSeconds[n] / 1e9;
+
+  return bandwidth;
+}
@@ -1,40 +1,216 @@
 #pragma once
 
 #include "quadtree.hpp"
+#include "Variants.hpp"
+#include "SpatialHash.hpp"
+#include "Diagnostics.hpp"
+#include "DensityMap.hpp"
+#include "InteractionLists.hpp"
+#include "Autotuner.hpp"
+#include "HilbertOrder.hpp"
 #include "opencl-bruteforce/RuntimeOpenCL.hpp"
+#include "distributed/Domain.hpp"
+
+class ParticleSystem {
+  friend class Autotuner;
+  friend class Ensemble;
 
-class ParticleSystem : public sf::Drawable, public sf::Transformable {
   public:
-    ParticleSystem(const sf::Texture* texture);
+    // Seconds the last step spent in each phase. On the GPU the force kernel integrates as well.
+    struct StepTimes {
+      float tree = 0.f;
+      float force = 0.f;
+      float integrate = 0.f;
+      float vertices = 0.f;
+    };
+
+    // Threads value for a system without workers, stepped from the jobs of another pool
+    static constexpr uint32_t serialThreads = ~0u;
+
+    // 0 threads uses every hardware thread. Pinned pools also place particle and tree memory on the workers' NUMA nodes.
+    ParticleSystem(uint32_t count = INITIAL_PARTICLES, uint32_t threads = 0, bool pinned = PIN_THREADS);
     ~ParticleSystem();
 
-    [[nodiscard]] const sf::Text& getTimerText() const;
+    [[nodiscard]] const Variant& getVariant() const;
+    [[nodiscard]] const Diagnostics& getDiagnostics() const;
+    [[nodiscard]] const StepTimes& getStepTimes() const;
+    [[nodiscard]] uint64_t getInteractions() const; // Of the last step
+    [[nodiscard]] const char* getEngineName() const;
+    [[nodiscard]] const ThreadPool& getThreadPool() const;
+    void countTreeNodes(uint32_t& nodes, uint32_t& depth) const;
+    [[nodiscard]] size_t getFarFieldCount() const; // Outliers left out of the tree at the last build
+
+    // Bodies are appended, or taken out by moving the last body into their place. Storage grows geometrically on the
+    // host and on the device, so a stream of small edits reallocates nothing.
+    void addParticles(const std::vector<Particle>& bodies);
+    void removeParticle(size_t index);
+    size_t removeEscaped(float distance); // Bodies farther than this from the center, returns how many
+    [[nodiscard]] size_t getParticleCount() const;
 
+    // Bodies of the last step, fetched from the device first if it is ahead. Valid until the next step or edit.
+    [[nodiscard]] const std::vector<Particle>& getParticles();
+
+    void setVariant(size_t index);
+    void nextVariant();
     void toggleGpuMode();
+    void toggleMerging();
+
+    // Flips the engine toggles to match, bodies are handed over as toggleGpuMode does
+    void setEngine(Engine engine);
+    [[nodiscard]] Engine getEngine() const;
+
+    // Times the engines at the first step and whenever the workload changes, then runs the fastest
+    void setAutotune(bool enabled);
+    [[nodiscard]] const Autotuner* getAutotuner() const; // nullptr when off
+
+    // Keeps the tree and the interaction lists across steps while the drift allows (single process CPU path)
+    void toggleInteractionCache();
+
+    // Sorts the bodies along a Hilbert curve at an interval tuned from the force pass times (CPU, single process)
+    void toggleReordering();
+    [[nodiscard]] const HilbertOrder* getOrdering() const; // nullptr when off
+
+    // 0 disables the diagnostics
+    void setDiagnosticsInterval(uint32_t interval);
+
+    // Keeps this rank's share of the bodies and splits the domain between the ranks from now on (takes ownership)
+    void distribute(Domain* domain);
+
     void update(float dt);
-    void drawGrid(sf::RenderTarget& target, const uint32_t& limit = QUAD_TREE_MAX_DEPTH) const;
+
+    // World rectangle on screen and its size of one pixel, used to cull and aggregate through the tree
+    void setCamera(const nb::FloatRect& viewport, float pixelSize);
+    void toggleCulling();
+
+    void accumulateDensity(DensityMap& map);
+
+    // Read bandwidth of the particle store in GB/s, per NUMA node of the workers
+    std::vector<double> measureBandwidth(uint32_t passes);
+
+    // Quads of the last step, 4 vertices per body or per aggregate when culling. Valid until the next step.
+    [[nodiscard]] const nb::Vertex* getVertices() const;
+    [[nodiscard]] size_t getVertexCount() const;
+
+    // Boundaries of the tree nodes down to that depth, appended
+    void collectGrid(uint32_t limit, std::vector<nb::FloatRect>& rects) const;
 
   private:
-    const sf::Texture* texture;
-    const sf::Vector2f center{WIDTH * 0.5f, HEIGHT * 0.5f};
+    const nb::Vector2f center{WIDTH * 0.5f, HEIGHT * 0.5f};
 
     std::vector<Particle> particles;
-    sf::VertexArray vertices{sf::Quads, INITIAL_PARTICLES * 4};
-    qt::Rectangle initBoundary{center.x, center.y, center.x, center.y};
+    std::vector<nb::Vertex> vertices = std::vector<nb::Vertex>(INITIAL_PARTICLES * 4);
     qt::Node* qt = nullptr;
+    nb::FloatRect root{0.f, 0.f, WIDTH, HEIGHT}; // Square around all but the outliers, fit at every build
+    std::vector<qt::Node*> subtrees;
+    std::vector<qt::Node*> levelNodes; // Refitted in parallel
+    std::vector<std::vector<std::vector<const Particle*>>> buckets; // Per slice, per subtree
+
+    // Extent of the bodies per slice, and samples of their coordinates for the quantiles
+    struct Extent {
+      nb::Vector2f min, max;
+    };
+    std::vector<Extent> extents;
+    std::vector<float> sampleX, sampleY;
+
+    // Outliers as a tree of their own over every body, so they neither stretch the main tree nor drop out of it
+    qt::Node* farField = nullptr;
+    nb::FloatRect farRoot;
+    bool hasOutliers = false;
+    std::vector<std::vector<const Particle*>> farSlices;
+    std::vector<const Particle*> farBodies;
     ThreadPool tp;
+    const Variant* variant = &Variants::table[Variants::defaultIndex()];
 
     RuntimeOpenCL* gpuCalc = nullptr;
     bool useGpu = false;
+    bool directSum = false;
+    bool gpuVertices = false; // The last GPU step wrote the quads itself
+    bool deviceAhead = false; // Steps only the device has, the host particles stay the state of record otherwise
+    bool hostAhead = false;   // CPU steps the device has not been given yet
+
+    Domain* domain = nullptr;
+    std::vector<Particle> remoteParticles; // Moments received from the other ranks
+
+    bool culling = false; // Costs a tree build every frame, even on the GPU path that needs none
+    nb::FloatRect viewport{0.f, 0.f, WIDTH, HEIGHT};
+    float pixelSize = 1.f;
+    std::vector<Splat> splats; // What the camera sees, for the density map
+
+    InteractionLists interactions;
+    std::vector<Particle> reference; // Fresh walk of the tree to compare the cached lists against
+    bool cachingInteractions = false;
+    float listUpkeepSum = 0.f;
+    float listSolveSum = 0.f;
+    uint32_t listSteps = 0;
+    uint32_t listBuilds = 0;
+
+    SpatialHash spatialHash;
+    std::vector<SpatialHash::Pair> closePairs;
+    std::vector<uint8_t> mergeState;
+    bool merging = false;
+
+    nb::Clock stepClock;
+    StepTimes stepTimes;
+    uint64_t stepInteractions = 0;
+    std::vector<uint64_t> sliceInteractions;
+    float stepTimeSum = 0.f;
+    uint32_t mergeSteps = 0;
+    uint32_t steps = 0;
+    uint64_t lastBusyTime = 0; // Of the pool at the end of the last step
+
+    Autotuner* autotuner = nullptr;
+    HilbertOrder* ordering = nullptr;
+
+    // Forces, integration and quads of a step as tasks per chunk of bodies, see updateGraph
+    TaskGraph graph;
+    std::vector<Extent> graphBounds;          // Of the bodies of every chunk
+    std::vector<float> graphReach;            // Per slice, then reduced: how far bodies may be and still read the chunk
+    std::vector<const qt::Node*> graphLeaves;
+    std::vector<uint64_t> graphInteractions;  // Per chunk
+    bool graphVertices = false;               // The graph wrote the quads of the last step
+    float graphWallSum = 0.f;
+    float graphWorkSum = 0.f;
+    float graphPathSum = 0.f;
+    uint32_t graphSteps = 0;
+
+    Diagnostics initialDiagnostics;
+    Diagnostics diagnostics;
+    bool hasInitialDiagnostics = false;
+    uint32_t diagnosticsInterval = 0;
+    std::ofstream diagnosticsLog;
 
   private:
-    virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const;
+    void step(float dt);
+    void restore(const std::vector<Particle>& bodies); // Bodies of a snapshot, with every cache over them dropped
+    void reserveParticles(size_t count); // Doubles the storage when needed, first-touched again on pinned pools
+    void beginEdit();
+    void endEdit();
 
     void updateQuadTree();
+    void updateQuadTreeDistributed();
+    void updateBounds();
+    void updateFarField();
+    uint64_t solveFarField(std::vector<Particle>& bodies);
+    void updateQuadTreeParallel();
+    void updateMoments();
     void updateAttraction();
-    void updateAttractionThreaded(int begin, int end);
+    uint64_t updateAttractionThreaded(int begin, int end);
+    void updateAttractionDirect();
     void updateAttractionGpu(float dt);
+    void syncHost();   // One download if the device is ahead
+    void syncDevice(); // One upload if the host is ahead
+    void updateInteractionLists();
+    void updateAttractionCached();
+    void reportInteractions(float walkTime);
+    void updateGraph(float dt);
+    void reportGraph();
     void updateParticles(float dt);
     void updateVertices();
+    void copyVertices(size_t begin, size_t end);
+    void updateVisible();
+    void mergeCloseEncounters();
+    void reportMerging();
+    void updateDiagnostics();
+    void publishMetrics();
 };
 
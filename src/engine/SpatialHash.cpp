@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "SpatialHash.hpp"
+
+uint32_t SpatialHash::bucket(int cx, int cy) const {
+  return (static_cast<uint32_t>(cx) * 73856093u ^ static_cast<uint32_t>(cy) * 19349663u) & mask;
+}
+
+int SpatialHash::cell(float v) const {
+  return static_cast<int>(std::floor(v / cellSize));
+}
+
+void SpatialHash::findPairs(const std::vector<Particle>& particles, float radius, ThreadPool& tp, std::vector<Pair>& out) {
+  out.clear();
+  if (particles.size() < 2) return;
+
+  cellSize = radius;
+  build(particles, tp);
+
+  found.resize(tp.size());
+  tp.parallelFor(particles.size(), [this, &particles, radius](size_t begin, size_t end, uint32_t slice) {
+    found[slice].clear();
+    query(particles, radius * radius, begin, end, found[slice]);
+  });
+
+  for (const std::vector<Pair>& f : found)
+    out.insert(out.end(), f.begin(), f.end());
+
+  // Neighbouring cells may share a bucket, so the same pair can be reported twice
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void SpatialHash::build(const std::vector<Particle>& particles, ThreadPool& tp) {
+  const uint32_t n = particles.size();
+  const uint32_t tableSize = std::bit_ceil(n * 2);
+  mask = tableSize - 1;
+
+  keys.resize(n);
+  sorted.resize(n);
+  if (starts.size() != tableSize + 1) {
+    starts = std::vector<std::atomic<uint32_t>>(tableSize + 1);
+    cursors = std::vector<std::atomic<uint32_t>>(tableSize);
+  }
+  for (std::atomic<uint32_t>& s : starts)
+    s.store(0, std::memory_order_relaxed);
+
+  // 1. Hash every particle and count the bucket sizes
+  tp.parallelFor(n, [this, &particles](size_t begin, size_t end, uint32_t) {
+    for (size_t j = begin; j < end; j++) {
+      const nb::Vector2f& pos = particles[j].getPosition();
+      keys[j] = bucket(cell(pos.x), cell(pos.y));
+      starts[keys[j] + 1].fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  // 2. Exclusive prefix sum turns the sizes into offsets
+  for (uint32_t b = 1; b <= tableSize; b++)
+    starts[b].store(starts[b] + starts[b - 1], std::memory_order_relaxed);
+
+  // 3. Scatter the indices, using a copy of the offsets as cursors
+  for (uint32_t b = 0; b < tableSize; b++)
+    cursors[b].store(starts[b], std::memory_order_relaxed);
+
+  tp.parallelFor(n, [this](size_t begin, size_t end, uint32_t) {
+    for (size_t j = begin; j < end; j++)
+      sorted[cursors[keys[j]].fetch_add(1, std::memory_order_relaxed)] = j;
+  });
+}
+
+void SpatialHash::query(const std::vector<Particle>& particles, float radiusSq, size_t begin, size_t end, std::vector<Pair>& out) const {
+  for (size_t i = begin; i < end; i++) {
+    const nb::Vector2f& p1 = particles[i].getPosition();
+    int cx = cell(p1.x);
+    int cy = cell(p1.y);
+
+    for (int dy = -1; dy <= 1; dy++)
+      for (int dx = -1; dx <= 1; dx++) {
+        uint32_t b = bucket(cx + dx, cy + dy);
+        uint32_t last = starts[b + 1].load(std::memory_order_relaxed);
+
+        for (uint32_t k = starts[b].load(std::memory_order_relaxed); k < last; k++) {
+          uint32_t j = sorted[k];
+          if (j <= i) continue;
+
+          nb::Vector2f d = particles[j].getPosition() - p1;
+          if (d.x * d.x + d.y * d.y < radiusSq)
+            out.push_back({static_cast<uint32_t>(i), j});
+        }
+      }
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "Particle.hpp"
+
+// Uniform grid hashed into a flat table (counting sort by bucket), rebuilt every query
+class SpatialHash {
+  public:
+    using Pair = std::pair<uint32_t, uint32_t>;
+
+    // Every pair (i < j) closer than the radius, sorted
+    void findPairs(const std::vector<Particle>& particles, float radius, ThreadPool& tp, std::vector<Pair>& out);
+
+  private:
+    float cellSize = 1.f;
+    uint32_t mask = 0;
+
+    std::vector<uint32_t> keys;                // Bucket of each particle
+    std::vector<uint32_t> sorted;              // Particle indices grouped by bucket
+    std::vector<std::atomic<uint32_t>> starts; // Bucket offsets into sorted (size + 1)
+    std::vector<std::atomic<uint32_t>> cursors;
+    std::vector<std::vector<Pair>> found;      // Per job results
+
+  private:
+    uint32_t bucket(int cx, int cy) const;
+    int cell(float v) const;
+
+    void build(const std::vector<Particle>& particles, ThreadPool& tp);
+    void query(const std::vector<Particle>& particles, float radiusSq, size_t begin, size_t end, std::vector<Pair>& out) const;
+};
@@ -4,15 +4,16 @@
 
 #define PI 3.14159265359f
 
-void Spawner::spiral(std::vector<Particle>& container, sf::Vector2f center) {
+void Spawner::spiral(std::vector<Particle>& container, nb::Vector2f center, uint32_t count) {
   float stepRad = (2.f * PI) / SPIRAL_ARMS;
+  int armLength = count / SPIRAL_ARMS / SPIRAL_ARMS_WIDTH;
 
   for (int i = 0; i < SPIRAL_ARMS; i++) {
     float startRad = i * stepRad;
     for (int j = 0; j < SPIRAL_ARMS_WIDTH; j++) {
       float startArmRad = j * PI / SPIRAL_ARMS_WIDTH_VALUE / SPIRAL_ARMS_WIDTH;
-      for (int k = 0; k < SPIRAL_ARM_LENGTH; k++) {
-        sf::Vector2f pos = center;
+      for (int k = 0; k < armLength; k++) {
+        nb::Vector2f pos = center;
         float rad = startRad + startArmRad + k * PI / SPIRAL_ARM_TWIST_VALUE;
         pos += {cosf(rad) * k, sinf(rad) * k};
         container.push_back(Particle(pos));
@@ -21,11 +22,42 @@ void Spawner::spiral(std::vector<Particle>& container, sf::Vector2f center) {
   }
 }
 
+void Spawner::spiral(std::vector<Particle>& container, nb::Vector2f center, uint64_t count, uint64_t begin, uint64_t end) {
+  // Same order as above: arms, then mini arms, then along the arm
+  float stepRad = (2.f * PI) / SPIRAL_ARMS;
+  uint64_t armLength = count / SPIRAL_ARMS / SPIRAL_ARMS_WIDTH;
+
+  for (uint64_t index = begin; index < end; index++) {
+    uint64_t i = index / (armLength * SPIRAL_ARMS_WIDTH);
+    uint64_t j = index / armLength % SPIRAL_ARMS_WIDTH;
+    uint64_t k = index % armLength;
+
+    float rad = i * stepRad + j * PI / SPIRAL_ARMS_WIDTH_VALUE / SPIRAL_ARMS_WIDTH + k * PI / SPIRAL_ARM_TWIST_VALUE;
+    container.push_back(Particle(center + nb::Vector2f{cosf(rad) * k, sinf(rad) * k}));
+  }
+}
+
+uint64_t Spawner::spiralSize(uint64_t count) {
+  return count / SPIRAL_ARMS / SPIRAL_ARMS_WIDTH * SPIRAL_ARMS * SPIRAL_ARMS_WIDTH;
+}
+
 void Spawner::random(std::vector<Particle>& container, bool heavyCenter) {
   if (heavyCenter)
     container.push_back(Particle({WIDTH * 0.5f, HEIGHT * 0.5f}, 300.f, 5.f));
 
   for (int i = 0; i < INITIAL_PARTICLES - 1; i++)
-    container.push_back(Particle(sf::Vector2f(rand() % WIDTH, rand() % HEIGHT)));
+    container.push_back(Particle(nb::Vector2f(rand() % WIDTH, rand() % HEIGHT)));
 }
 
+
+void Spawner::cloud(std::vector<Particle>& container, nb::Vector2f center, float radius, uint32_t count, nb::Vector2f velocity) {
+  for (uint32_t i = 0; i < count; i++) {
+    // Square root of the radius spreads them evenly over the area
+    float r = radius * std::sqrt(rand() / static_cast<float>(RAND_MAX));
+    float rad = 2.f * PI * rand() / static_cast<float>(RAND_MAX);
+
+    Particle p(center + nb::Vector2f{cosf(rad) * r, sinf(rad) * r});
+    p.setVelocity(velocity);
+    container.push_back(p);
+  }
+}
@@ -5,7 +5,15 @@
 #include "Particle.hpp"
 
 struct Spawner {
-  static void spiral(std::vector<Particle>& container, sf::Vector2f center);
+  static void spiral(std::vector<Particle>& container, nb::Vector2f center, uint32_t count = INITIAL_PARTICLES);
+
+  // Bodies [begin, end) of the spiral of count bodies, so one larger than memory can be written out in parts.
+  // spiralSize is how many bodies that spiral has, its arms are cut to equal lengths.
+  static void spiral(std::vector<Particle>& container, nb::Vector2f center, uint64_t count, uint64_t begin, uint64_t end);
+  static uint64_t spiralSize(uint64_t count);
   static void random(std::vector<Particle>& container, bool heavyCenter = true);
+
+  // Uniform disc of bodies sharing one velocity
+  static void cloud(std::vector<Particle>& container, nb::Vector2f center, float radius, uint32_t count, nb::Vector2f velocity = {});
 };
 
@@ -0,0 +1,131 @@
+#include <cstdio>
+
+#include "Variants.hpp"
+
+template<class T>
+static void insertAll(qt::Node* root, std::vector<Particle>& particles) {
+  for (Particle& particle : particles)
+    root->insert<T>(&particle);
+}
+
+template<class T>
+static void insertRange(qt::Node* root, const Particle* const* begin, const Particle* const* end) {
+  for (const Particle* const* p = begin; p != end; p++)
+    root->place<T>(*p);
+}
+
+template<class T>
+static uint64_t solveRange(qt::Node* root, Particle* begin, Particle* end) {
+  uint64_t interactions = 0;
+  for (Particle* p = begin; p != end; p++)
+    interactions += root->solveAttraction<T>(p);
+
+  return interactions;
+}
+
+template<class T>
+static void solveDirect(const std::vector<Particle>& particles, Particle* begin, Particle* end) {
+  for (Particle* p2 = begin; p2 != end; p2++)
+    for (const Particle& p1 : particles)
+      if (p2 != &p1)
+        p2->attractTo<T::softening>(p1.getPosition(), p1.getMass());
+}
+
+template<class T>
+static void collectEssential(const qt::Node* root, const qt::Rectangle& region, std::vector<qt::Node::Gravity>& out) {
+  root->collectEssential<T>(region, out);
+}
+
+template<class T>
+static void collectInteractions(const qt::Node* root, const qt::Rectangle& bounds, std::vector<const qt::Node*>& far, std::vector<const qt::Node*>& near) {
+  root->collectInteractions<T>(bounds, far, near);
+}
+
+template<class T>
+static void solveInteractions(const qt::Node* leaf, const std::vector<const qt::Node*>& far, const std::vector<const qt::Node*>& near) {
+  leaf->solveInteractions<T>(far, near);
+}
+
+template<class T>
+static double potentialEnergy(const qt::Node* root, const Particle* begin, const Particle* end) {
+  double energy = 0.0;
+  for (const Particle* p = begin; p != end; p++)
+    energy += p->getMass() * root->solvePotential<T>(p);
+
+  return energy;
+}
+
+#define OPENING_VARIANT(limit, theta, softening, opening) {                        \
+  limit, theta, softening, qt::Opening::opening,                                   \
+  qt::Tuning<limit, theta, softening, qt::Opening::opening>::groupTheta,           \
+  qt::Tuning<limit, theta, softening, qt::Opening::opening>::reach,                \
+  &insertAll<qt::Tuning<limit, theta, softening, qt::Opening::opening>>,           \
+  &insertRange<qt::Tuning<limit, theta, softening, qt::Opening::opening>>,         \
+  &solveRange<qt::Tuning<limit, theta, softening, qt::Opening::opening>>,          \
+  &solveDirect<qt::Tuning<limit, theta, softening, qt::Opening::opening>>,         \
+  &collectEssential<qt::Tuning<limit, theta, softening, qt::Opening::opening>>,    \
+  &collectInteractions<qt::Tuning<limit, theta, softening, qt::Opening::opening>>, \
+  &solveInteractions<qt::Tuning<limit, theta, softening, qt::Opening::opening>>,   \
+  &potentialEnergy<qt::Tuning<limit, theta, softening, qt::Opening::opening>>      \
+}
+#define VARIANT(limit, theta, softening) OPENING_VARIANT(limit, theta, softening, Geometric)
+
+const Variant Variants::table[] = {
+  VARIANT(4,  0.3f, 0.01f), VARIANT(4,  0.3f, 0.1f),
+  VARIANT(4,  0.5f, 0.01f), VARIANT(4,  0.5f, 0.1f),
+  VARIANT(4,  0.8f, 0.01f), VARIANT(4,  0.8f, 0.1f),
+  VARIANT(10, 0.3f, 0.01f), VARIANT(10, 0.3f, 0.1f),
+  VARIANT(10, 0.5f, 0.01f), VARIANT(10, 0.5f, 0.1f),
+  VARIANT(10, 0.8f, 0.01f), VARIANT(10, 0.8f, 0.1f),
+  VARIANT(32, 0.3f, 0.01f), VARIANT(32, 0.3f, 0.1f),
+  VARIANT(32, 0.5f, 0.01f), VARIANT(32, 0.5f, 0.1f),
+  VARIANT(32, 0.8f, 0.01f), VARIANT(32, 0.8f, 0.1f),
+
+  // Opened by the extent of the bodies around the center of mass rather than by the cell
+  OPENING_VARIANT(4,  0.3f, 0.01f, Bmax), OPENING_VARIANT(4,  0.3f, 0.1f, Bmax),
+  OPENING_VARIANT(4,  0.5f, 0.01f, Bmax), OPENING_VARIANT(4,  0.5f, 0.1f, Bmax),
+  OPENING_VARIANT(4,  0.8f, 0.01f, Bmax), OPENING_VARIANT(4,  0.8f, 0.1f, Bmax),
+  OPENING_VARIANT(10, 0.3f, 0.01f, Bmax), OPENING_VARIANT(10, 0.3f, 0.1f, Bmax),
+  OPENING_VARIANT(10, 0.5f, 0.01f, Bmax), OPENING_VARIANT(10, 0.5f, 0.1f, Bmax),
+  OPENING_VARIANT(10, 0.8f, 0.01f, Bmax), OPENING_VARIANT(10, 0.8f, 0.1f, Bmax),
+  OPENING_VARIANT(32, 0.3f, 0.01f, Bmax), OPENING_VARIANT(32, 0.3f, 0.1f, Bmax),
+  OPENING_VARIANT(32, 0.5f, 0.01f, Bmax), OPENING_VARIANT(32, 0.5f, 0.1f, Bmax),
+  OPENING_VARIANT(32, 0.8f, 0.01f, Bmax), OPENING_VARIANT(32, 0.8f, 0.1f, Bmax),
+
+  // Opened by the error against the previous acceleration, theta is the relative tolerance
+  OPENING_VARIANT(4,  0.001f, 0.01f, Acceleration), OPENING_VARIANT(4,  0.001f, 0.1f, Acceleration),
+  OPENING_VARIANT(4,  0.005f, 0.01f, Acceleration), OPENING_VARIANT(4,  0.005f, 0.1f, Acceleration),
+  OPENING_VARIANT(4,  0.02f,  0.01f, Acceleration), OPENING_VARIANT(4,  0.02f,  0.1f, Acceleration),
+  OPENING_VARIANT(10, 0.001f, 0.01f, Acceleration), OPENING_VARIANT(10, 0.001f, 0.1f, Acceleration),
+  OPENING_VARIANT(10, 0.005f, 0.01f, Acceleration), OPENING_VARIANT(10, 0.005f, 0.1f, Acceleration),
+  OPENING_VARIANT(10, 0.02f,  0.01f, Acceleration), OPENING_VARIANT(10, 0.02f,  0.1f, Acceleration),
+  OPENING_VARIANT(32, 0.001f, 0.01f, Acceleration), OPENING_VARIANT(32, 0.001f, 0.1f, Acceleration),
+  OPENING_VARIANT(32, 0.005f, 0.01f, Acceleration), OPENING_VARIANT(32, 0.005f, 0.1f, Acceleration),
+  OPENING_VARIANT(32, 0.02f,  0.01f, Acceleration), OPENING_VARIANT(32, 0.02f,  0.1f, Acceleration),
+
+  // The compiled in defaults, found by defaultIndex() when they are not on the grid above
+  VARIANT(QUAD_TREE_CONTAINER_LIMIT, QUAD_TREE_THETA, ZERO_DIVISION_PREVENT_VALUE),
+};
+
+const size_t Variants::count = sizeof(table) / sizeof(table[0]);
+
+size_t Variants::defaultIndex() {
+  return find(QUAD_TREE_CONTAINER_LIMIT, QUAD_TREE_THETA, ZERO_DIVISION_PREVENT_VALUE);
+}
+
+size_t Variants::find(uint32_t containerLimit, float theta, float softening, qt::Opening opening) {
+  for (size_t i = 0; i < count; i++)
+    if (table[i].containerLimit == containerLimit && table[i].theta == theta && table[i].softening == softening && table[i].opening == opening)
+      return i;
+
+  printf("No compiled variant for limit %u, %s %g, softening %g\n", containerLimit, name(opening), theta, softening);
+  return defaultIndex();
+}
+
+const char* Variants::name(qt::Opening opening) {
+  switch (opening) {
+    case qt::Opening::Bmax:         return "bmax";
+    case qt::Opening::Acceleration: return "acceleration";
+    default:                        return "theta";
+  }
+}
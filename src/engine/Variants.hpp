@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "quadtree.hpp"
+
+// Every entry is a separate instantiation of the tree and interaction code
+// with its tuning parameters baked in as constants
+struct Variant {
+  uint32_t containerLimit;
+  float theta;      // Relative force tolerance with the acceleration criterion
+  float softening;
+  qt::Opening opening;
+  float groupTheta; // Of the geometric tests made for whole groups of bodies
+  float reach;      // Farthest a body may be from a node it opens, in sizes of the node
+
+  void (*insert)(qt::Node* root, std::vector<Particle>& particles);
+  void (*insertRange)(qt::Node* root, const Particle* const* begin, const Particle* const* end);
+  uint64_t (*solveAttraction)(qt::Node* root, Particle* begin, Particle* end); // Interactions it took
+  void (*solveDirect)(const std::vector<Particle>& particles, Particle* begin, Particle* end); // Every pair, no tree
+  void (*collectEssential)(const qt::Node* root, const qt::Rectangle& region, std::vector<qt::Node::Gravity>& out);
+  void (*collectInteractions)(const qt::Node* root, const qt::Rectangle& bounds, std::vector<const qt::Node*>& far, std::vector<const qt::Node*>& near);
+  void (*solveInteractions)(const qt::Node* leaf, const std::vector<const qt::Node*>& far, const std::vector<const qt::Node*>& near);
+  double (*potentialEnergy)(const qt::Node* root, const Particle* begin, const Particle* end);
+};
+
+struct Variants {
+  static const Variant table[];
+  static const size_t count;
+
+  // Index of the entry matching the parameters from preferences.hpp
+  static size_t defaultIndex();
+  static size_t find(uint32_t containerLimit, float theta, float softening, qt::Opening opening = qt::Opening::Geometric);
+
+  static const char* name(qt::Opening opening);
+};
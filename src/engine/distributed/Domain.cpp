@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "Domain.hpp"
+
+#define SPLITTER_SAMPLES 256 // Keys every rank contributes to pick the splitters
+
+template<class T>
+static void pack(std::vector<char>& out, const T* data, size_t count) {
+  out.resize(count * sizeof(T));
+  memcpy(out.data(), data, out.size());
+}
+
+template<class T>
+static void unpack(const std::vector<char>& in, std::vector<T>& out) {
+  out.resize(in.size() / sizeof(T));
+  memcpy(out.data(), in.data(), out.size() * sizeof(T));
+}
+
+// Interleaves the bits of 16 bit cell coordinates
+static uint32_t morton(uint32_t x, uint32_t y) {
+  auto spread = [](uint32_t v) {
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+  };
+
+  return spread(x) | (spread(y) << 1);
+}
+
+bool Domain::Bounds::empty() const {
+  return left > right;
+}
+
+Domain::Domain(Transport* transport) : transport(transport) {
+  outgoing.resize(transport->size());
+  incoming.resize(transport->size());
+}
+
+Domain::~Domain() {
+  delete transport;
+}
+
+int Domain::rank() const { return transport->rank(); }
+int Domain::size() const { return transport->size(); }
+
+bool Domain::hasFailed() const {
+  return failed;
+}
+
+void Domain::exchange() {
+  if (!failed && transport->exchange(outgoing, incoming)) return;
+  failed = true;
+
+  for (int r = 0; r < size(); r++)
+    incoming[r].clear();
+  incoming[rank()] = outgoing[rank()];
+}
+
+void Domain::scatter(std::vector<Particle>& particles) const {
+  size_t slice = particles.size() / size();
+  size_t begin = rank() * slice;
+  size_t end = rank() == size() - 1 ? particles.size() : begin + slice;
+
+  particles.erase(particles.begin() + end, particles.end());
+  particles.erase(particles.begin(), particles.begin() + begin);
+}
+
+Domain::Bounds Domain::bounds(const std::vector<Particle>& particles) {
+  constexpr float inf = std::numeric_limits<float>::infinity();
+  Bounds b{inf, inf, -inf, -inf};
+
+  for (const Particle& p : particles) {
+    const nb::Vector2f& pos = p.getPosition();
+    b.left   = std::min(b.left, pos.x);
+    b.top    = std::min(b.top, pos.y);
+    b.right  = std::max(b.right, pos.x);
+    b.bottom = std::max(b.bottom, pos.y);
+  }
+
+  return b;
+}
+
+std::vector<Domain::Bounds> Domain::allGather(const Bounds& b) {
+  for (std::vector<char>& out : outgoing)
+    pack(out, &b, 1);
+  exchange();
+
+  constexpr float inf = std::numeric_limits<float>::infinity();
+  std::vector<Bounds> all(size(), Bounds{inf, inf, -inf, -inf});
+  for (int r = 0; r < size(); r++)
+    if (incoming[r].size() == sizeof(Bounds))
+      memcpy(&all[r], incoming[r].data(), sizeof(Bounds));
+
+  return all;
+}
+
+qt::Rectangle Domain::decompose(std::vector<Particle>& particles) {
+  // 1. Global bounds, squared so that the cells stay square
+  Bounds global = bounds(particles);
+  for (const Bounds& b : allGather(global)) {
+    global.left   = std::min(global.left, b.left);
+    global.top    = std::min(global.top, b.top);
+    global.right  = std::max(global.right, b.right);
+    global.bottom = std::max(global.bottom, b.bottom);
+  }
+
+  float x = (global.left + global.right) * 0.5f;
+  float y = (global.top + global.bottom) * 0.5f;
+  float half = std::max(global.right - global.left, global.bottom - global.top) * 0.5f + 1.f;
+  float cell = half * 2.f / 0x10000;
+
+  // 2. Curve keys and the splitters between the ranks
+  std::vector<uint32_t> keys(particles.size());
+  for (size_t i = 0; i < particles.size(); i++) {
+    const nb::Vector2f& pos = particles[i].getPosition();
+    uint32_t cx = std::min<uint32_t>((pos.x - x + half) / cell, 0xffff);
+    uint32_t cy = std::min<uint32_t>((pos.y - y + half) / cell, 0xffff);
+    keys[i] = morton(cx, cy);
+  }
+  computeSplitters(keys);
+
+  // 3. Migrate the bodies outside of this rank's range
+  std::vector<std::vector<Body>> leaving(size());
+  size_t w = 0;
+  for (size_t i = 0; i < particles.size(); i++) {
+    int owner = std::upper_bound(splitters.begin(), splitters.end(), keys[i]) - splitters.begin();
+    if (owner == rank()) {
+      if (w != i) particles[w] = particles[i];
+      w++;
+    } else {
+      const Particle& p = particles[i];
+      leaving[owner].push_back({
+        p.getPosition().x, p.getPosition().y,
+        p.getVelocity().x, p.getVelocity().y,
+        p.getMass(), p.getRadius()
+      });
+    }
+  }
+  particles.erase(particles.begin() + w, particles.end());
+
+  for (int r = 0; r < size(); r++)
+    pack(outgoing[r], leaving[r].data(), leaving[r].size());
+  exchange();
+
+  std::vector<Body> arrived;
+  for (int r = 0; r < size(); r++) {
+    if (r == rank()) continue;
+    unpack(incoming[r], arrived);
+    for (const Body& b : arrived) {
+      particles.emplace_back(nb::Vector2f{b.x, b.y}, b.mass, b.radius);
+      particles.back().setVelocity({b.vx, b.vy});
+    }
+  }
+
+  // 4. Regions of the other ranks tell which moments they need from this one
+  regions = allGather(bounds(particles));
+
+  return qt::Rectangle(x, y, half, half);
+}
+
+void Domain::computeSplitters(const std::vector<uint32_t>& keys) {
+  // Every rank sends its body count and evenly spaced keys of its sorted keys
+  std::vector<uint32_t> sorted = keys;
+  std::sort(sorted.begin(), sorted.end());
+
+  std::vector<uint32_t> samples{static_cast<uint32_t>(sorted.size())};
+  size_t count = std::min<size_t>(sorted.size(), SPLITTER_SAMPLES);
+  for (size_t i = 0; i < count; i++)
+    samples.push_back(sorted[i * sorted.size() / count]);
+
+  for (std::vector<char>& out : outgoing)
+    pack(out, samples.data(), samples.size());
+  exchange();
+
+  // Each sample stands for (body count / sample count) bodies of its rank
+  std::vector<std::pair<uint32_t, double>> weighted;
+  double total = 0.0;
+  for (int r = 0; r < size(); r++) {
+    unpack(incoming[r], samples);
+    if (samples.size() < 2) continue;
+
+    double weight = static_cast<double>(samples[0]) / (samples.size() - 1);
+    for (size_t i = 1; i < samples.size(); i++)
+      weighted.push_back({samples[i], weight});
+    total += samples[0];
+  }
+  std::sort(weighted.begin(), weighted.end());
+
+  // Identical input on every rank, so every rank picks the same splitters
+  splitters.assign(size() - 1, std::numeric_limits<uint32_t>::max());
+  double accumulated = 0.0;
+  size_t next = 0;
+  for (const auto& [key, weight] : weighted) {
+    accumulated += weight;
+    while (next < splitters.size() && accumulated >= total * (next + 1) / size())
+      splitters[next++] = key;
+  }
+}
+
+void Domain::exchangeEssentialTree(const qt::Node* root, const Variant& variant, std::vector<Particle>& remote) {
+  std::vector<qt::Node::Gravity> moments;
+
+  for (int r = 0; r < size(); r++) {
+    moments.clear();
+    if (r != rank() && !regions[r].empty()) {
+      const Bounds& b = regions[r];
+      qt::Rectangle region((b.left + b.right) * 0.5f, (b.top + b.bottom) * 0.5f, (b.right - b.left) * 0.5f, (b.bottom - b.top) * 0.5f);
+      variant.collectEssential(root, region, moments);
+    }
+    pack(outgoing[r], moments.data(), moments.size());
+  }
+  exchange();
+
+  remote.clear();
+  for (int r = 0; r < size(); r++) {
+    if (r == rank()) continue;
+    unpack(incoming[r], moments);
+    for (const qt::Node::Gravity& g : moments)
+      remote.emplace_back(g.center, g.mass);
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include "Transport.hpp"
+#include "../Variants.hpp"
+
+// Splits the bodies between ranks by ranges of a Morton (Z-order) curve over the global bounds.
+// Every rank builds a tree of its own bodies plus the moments other ranks send as its locally essential tree (LET).
+class Domain {
+  public:
+    Domain(Transport* transport);
+    ~Domain();
+
+    [[nodiscard]] int rank() const;
+    [[nodiscard]] int size() const;
+
+    // A rank was lost during an exchange. This rank goes on with its own bodies only, the run should be stopped.
+    [[nodiscard]] bool hasFailed() const;
+
+    // Keeps this rank's share of bodies that every rank has spawned the same way
+    void scatter(std::vector<Particle>& particles) const;
+
+    // Moves bodies to the rank owning their curve range, returns the global root boundary
+    qt::Rectangle decompose(std::vector<Particle>& particles);
+
+    // Sends every rank the moments of the local tree it needs and receives theirs as pseudo particles
+    void exchangeEssentialTree(const qt::Node* root, const Variant& variant, std::vector<Particle>& remote);
+
+  private:
+    struct Bounds {
+      float left, top, right, bottom;
+      [[nodiscard]] bool empty() const;
+    };
+
+    struct Body {
+      float x, y, vx, vy, mass, radius;
+    };
+
+    Transport* transport;
+    std::vector<std::vector<char>> outgoing, incoming;
+    std::vector<Bounds> regions; // Bounds of the bodies every rank holds after migration
+    std::vector<uint32_t> splitters;
+    bool failed = false;
+
+  private:
+    static Bounds bounds(const std::vector<Particle>& particles);
+
+    void exchange(); // Of outgoing into incoming, nothing arrives from the other ranks once one is lost
+    std::vector<Bounds> allGather(const Bounds& b);
+    void computeSplitters(const std::vector<uint32_t>& keys);
+};
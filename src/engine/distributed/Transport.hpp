@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+
+// Message passing between the ranks of a distributed run.
+// Backends only have to implement the personalized all-to-all exchange, every collective is built on it.
+class Transport {
+  public:
+    virtual ~Transport() = default;
+
+    [[nodiscard]] virtual int rank() const = 0;
+    [[nodiscard]] virtual int size() const = 0;
+
+    // outgoing[r] is delivered to rank r, incoming[r] is what rank r sent to this one (both sized size()).
+    // False if a rank could not be reached, what arrived from the others is then incomplete.
+    [[nodiscard]] virtual bool exchange(const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) = 0;
+};
@@ -0,0 +1,200 @@
+#include <cerrno>
+#include <cstdio>
+
+#include "UnixSocketTransport.hpp"
+
+#ifdef __unix__
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+UnixSocketTransport::UnixSocketTransport(int rank, std::vector<int> peers)
+  : selfRank(rank), peers(std::move(peers)) {}
+
+UnixSocketTransport::~UnixSocketTransport() {
+  for (int fd : peers)
+    if (fd >= 0) close(fd);
+}
+
+UnixSocketTransport* UnixSocketTransport::fork(int ranks) {
+  // Buffered output would be printed once per process
+  fflush(stdout);
+
+  // sockets[i][j] is the end used by rank i to talk to rank j
+  std::vector<std::vector<int>> sockets(ranks, std::vector<int>(ranks, -1));
+  auto closeAll = [&sockets] {
+    for (std::vector<int>& ends : sockets)
+      for (int fd : ends)
+        if (fd >= 0) close(fd);
+  };
+
+  for (int i = 0; i < ranks; i++)
+    for (int j = i + 1; j < ranks; j++) {
+      int pair[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+        perror("socketpair");
+        closeAll();
+        return nullptr;
+      }
+      sockets[i][j] = pair[0];
+      sockets[j][i] = pair[1];
+    }
+
+  int rank = 0;
+  for (int r = 1; r < ranks; r++) {
+    pid_t pid = ::fork();
+    if (pid < 0) {
+      // The children started so far see their sockets hang up at the first exchange, and exit
+      perror("fork");
+      closeAll();
+      waitForRanks();
+      return nullptr;
+    }
+    if (pid == 0) {
+      rank = r;
+      break;
+    }
+  }
+
+  // Keep only the ends of this rank
+  for (int i = 0; i < ranks; i++)
+    for (int j = 0; j < ranks; j++)
+      if (i != rank && sockets[i][j] >= 0)
+        close(sockets[i][j]);
+
+  for (int fd : sockets[rank])
+    if (fd >= 0)
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  return new UnixSocketTransport(rank, sockets[rank]);
+}
+
+void UnixSocketTransport::waitForRanks() {
+  while (wait(nullptr) > 0);
+}
+
+int UnixSocketTransport::rank() const { return selfRank;    }
+int UnixSocketTransport::size() const { return peers.size(); }
+
+bool UnixSocketTransport::exchange(const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) {
+  const int n = size();
+  incoming.resize(n);
+  incoming[selfRank] = outgoing[selfRank];
+
+  // Every message is prefixed with its length. Reads and writes are interleaved with poll,
+  // so ranks sending large messages to each other at the same time can't deadlock on full socket buffers.
+  struct Progress {
+    uint64_t outLength = 0, inLength = 0;
+    size_t written = 0, read = 0;
+  };
+  std::vector<Progress> progress(n);
+  int pending = 0;
+
+  for (int r = 0; r < n; r++) {
+    if (r == selfRank) continue;
+    progress[r].outLength = outgoing[r].size();
+    pending += 2;
+  }
+
+  std::vector<pollfd> fds;
+  std::vector<int> fdRanks;
+  while (pending) {
+    fds.clear();
+    fdRanks.clear();
+    for (int r = 0; r < n; r++) {
+      if (r == selfRank) continue;
+      Progress& p = progress[r];
+      short events = 0;
+      if (p.written < sizeof(uint64_t) + p.outLength) events |= POLLOUT;
+      if (p.read < sizeof(uint64_t) || p.read < sizeof(uint64_t) + p.inLength) events |= POLLIN;
+      if (events) {
+        fds.push_back({peers[r], events, 0});
+        fdRanks.push_back(r);
+      }
+    }
+
+    int pollResult = poll(fds.data(), fds.size(), -1);
+    if (pollResult < 0 && errno == EINTR) continue;
+    if (pollResult < 0) {
+      perror("poll");
+      return false;
+    }
+
+    for (size_t i = 0; i < fds.size(); i++) {
+      const int r = fdRanks[i];
+      Progress& p = progress[r];
+
+      // A peer that hung up only shows through read, unless nothing is left to read from it
+      if (fds[i].revents & (POLLERR | POLLNVAL) || (fds[i].revents & POLLHUP && !(fds[i].events & POLLIN))) {
+        printf("Rank %d: rank %d is gone\n", selfRank, r);
+        return false;
+      }
+
+      if (fds[i].revents & POLLOUT) {
+        // send rather than write, so a peer gone in the meantime fails the call instead of raising SIGPIPE
+        ssize_t sent;
+        if (p.written < sizeof(uint64_t))
+          sent = send(peers[r], reinterpret_cast<const char*>(&p.outLength) + p.written, sizeof(uint64_t) - p.written, MSG_NOSIGNAL);
+        else
+          sent = send(peers[r], outgoing[r].data() + p.written - sizeof(uint64_t), sizeof(uint64_t) + p.outLength - p.written, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          printf("Rank %d: sending to rank %d failed\n", selfRank, r);
+          return false;
+        }
+        if (sent > 0) {
+          p.written += sent;
+          if (p.written == sizeof(uint64_t) + p.outLength) pending--;
+        }
+      }
+
+      if (fds[i].revents & (POLLIN | POLLHUP)) {
+        ssize_t received;
+        if (p.read < sizeof(uint64_t))
+          received = read(peers[r], reinterpret_cast<char*>(&p.inLength) + p.read, sizeof(uint64_t) - p.read);
+        else
+          received = read(peers[r], incoming[r].data() + p.read - sizeof(uint64_t), sizeof(uint64_t) + p.inLength - p.read);
+
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+          printf("Rank %d: rank %d has exited in the middle of an exchange\n", selfRank, r);
+          return false;
+        }
+        if (received > 0) {
+          p.read += received;
+          if (p.read == sizeof(uint64_t))
+            incoming[r].resize(p.inLength);
+          if (p.read == sizeof(uint64_t) + p.inLength) pending--;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+#else
+
+UnixSocketTransport::UnixSocketTransport(int rank, std::vector<int> peers)
+  : selfRank(rank), peers(std::move(peers)) {}
+
+UnixSocketTransport::~UnixSocketTransport() {}
+
+UnixSocketTransport* UnixSocketTransport::fork(int ranks) {
+  printf("Unix socket transport is not available on this platform\n");
+  return nullptr;
+}
+
+void UnixSocketTransport::waitForRanks() {}
+
+int UnixSocketTransport::rank() const { return selfRank;    }
+int UnixSocketTransport::size() const { return peers.size(); }
+
+bool UnixSocketTransport::exchange(const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) {
+  incoming = outgoing;
+  return true;
+}
+
+#endif
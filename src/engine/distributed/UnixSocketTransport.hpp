@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Transport.hpp"
+
+// Ranks are forked processes on one machine connected pairwise by socketpair(2)
+class UnixSocketTransport : public Transport {
+  public:
+    ~UnixSocketTransport();
+
+    // Forks ranks - 1 children, returns the transport of the calling process (rank 0 is the parent).
+    // Returns nullptr where Unix sockets are not available, or if the sockets or a child could not be created.
+    static UnixSocketTransport* fork(int ranks);
+
+    // Called by rank 0 once the run is over
+    static void waitForRanks();
+
+    [[nodiscard]] int rank() const override;
+    [[nodiscard]] int size() const override;
+
+    [[nodiscard]] bool exchange(const std::vector<std::vector<char>>& outgoing, std::vector<std::vector<char>>& incoming) override;
+
+  private:
+    UnixSocketTransport(int rank, std::vector<int> peers);
+
+    int selfRank;
+    std::vector<int> peers; // Socket of every other rank, -1 for itself
+};
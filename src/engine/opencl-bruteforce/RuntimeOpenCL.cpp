@@ -1,11 +1,20 @@
 // https://github.com/CobaltXII/cosmos/blob/master/cosmos_simulate.cpp
 
+#include <algorithm>
 #include <cassert>
 #include <string>
 
 #include "RuntimeOpenCL.hpp"
 
 #define ATTRIBUTE_COUNT 5
+#define MIN_CAPACITY 1024
+
+// The kernel writes the positions of nb::Vertex as floats
+static_assert(sizeof(nb::Vertex) == 5 * sizeof(float), "VERTEX_FLOATS of the kernel no longer matches nb::Vertex");
+
+// Wall time of the blocking transfers, read backs include the kernel they wait for
+static metrics::Histogram& uploadSeconds = metrics::histogram("nbody_opencl_transfer_seconds", "Wall time of a blocking host-device transfer", "direction=\"upload\"");
+static metrics::Histogram& downloadSeconds = metrics::histogram("nbody_opencl_transfer_seconds", "Wall time of a blocking host-device transfer", "direction=\"download\"");
 
 const cl_platform_info attributeTypes[ATTRIBUTE_COUNT] = {
   CL_PLATFORM_NAME,
@@ -23,7 +32,7 @@ const char* const attributeNames[ATTRIBUTE_COUNT] = {
   "CL_PLATFORM_EXTENSIONS"
 };
 
-RuntimeOpenCL::RuntimeOpenCL(const std::vector<Particle>& particles) : n(particles.size()) {
+RuntimeOpenCL::RuntimeOpenCL(const std::vector<Particle>& particles, bool multiDevice, uint32_t subDeviceUnits) {
   cl_platform_id platforms[64];
   cl_uint platformCount;
   cl_int platformsResult = clGetPlatformIDs(64, platforms, &platformCount);
@@ -47,7 +56,8 @@ RuntimeOpenCL::RuntimeOpenCL(const std::vector<Particle>& particles) : n(particl
 
   printf("\n");
 
-  for (int i = 0; i < platformCount; i++) {
+  if (multiDevice) selectDevices(subDeviceUnits);
+  for (cl_uint i = 0; !multiDevice && i < platformCount; i++) {
     cl_device_id devices[64];
     cl_uint deviceCount;
     cl_int deviceResult = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 64, devices, &deviceCount);
@@ -67,6 +77,10 @@ RuntimeOpenCL::RuntimeOpenCL(const std::vector<Particle>& particles) : n(particl
 
   assert(device);
 
+  char name[256] = "";
+  clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, nullptr);
+  deviceName = name;
+
   clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(maxDimensions), &maxDimensions, nullptr);
   printf("2.1 CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS: %zu\n", maxDimensions);
 
@@ -80,44 +94,31 @@ RuntimeOpenCL::RuntimeOpenCL(const std::vector<Particle>& particles) : n(particl
   for (int i = 0; i < maxDimensions; i++) printf("%zu ", maxDimensionsValues[i]);
   printf("\n\n");
 
+  // One context for every device, so the bodies and masses are buffers they share
+  std::vector<cl_device_id> ids = {device};
+  if (!slices.empty()) {
+    ids.clear();
+    for (const Slice& s : slices) ids.push_back(s.device);
+  }
+
   cl_int contextResult;
-  context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &contextResult);
+  context = clCreateContext(nullptr, ids.size(), ids.data(), nullptr, nullptr, &contextResult);
   assert(contextResult == CL_SUCCESS);
 
   cl_int commandQueueResult;
-  commandQueue = clCreateCommandQueueWithProperties(context, device, 0, &commandQueueResult);
-  assert(commandQueueResult == CL_SUCCESS);
-
-  currentParticles = new cl_float4[n];
-  nextParticles = new cl_float4[n];
-
-  for (int i = 0; i < n; i++) {
-    const Particle& p = particles[i];
-    currentParticles[i] = {
-      p.getPosition().x,
-      p.getPosition().y,
-      p.getVelocity().x,
-      p.getVelocity().y
-    };
+  if (slices.empty()) {
+    commandQueue = clCreateCommandQueueWithProperties(context, device, 0, &commandQueueResult);
+    assert(commandQueueResult == CL_SUCCESS);
+  } else {
+    const cl_queue_properties profiled[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    for (Slice& s : slices) {
+      s.queue = clCreateCommandQueueWithProperties(context, s.device, profiled, &commandQueueResult);
+      assert(commandQueueResult == CL_SUCCESS);
+      clGetDeviceInfo(s.device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(s.localSize), &s.localSize, nullptr);
+    }
+    commandQueue = slices[0].queue; // Uploads and downloads of the shared buffers
   }
 
-  // Clear the second state (fill the array with zeros).
-	memset(nextParticles, 0, n * sizeof(cl_float4));
-
-  cl_int gpuMallocResult1;
-  cl_int gpuMallocResult2;
-  gpuCurrentParticles = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_float4), nullptr, &gpuMallocResult1);
-  gpuNextParticles    = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_float4), nullptr, &gpuMallocResult2);
-  assert(gpuMallocResult1 == CL_SUCCESS);
-  assert(gpuMallocResult2 == CL_SUCCESS);
-
-  cl_int cpuCopyResult1;
-  cl_int cpuCopyResult2;
-  cpuCopyResult1 = clEnqueueWriteBuffer(commandQueue, gpuCurrentParticles, CL_TRUE, 0, n * sizeof(cl_float4), currentParticles, 0, nullptr, nullptr);
-  cpuCopyResult2 = clEnqueueWriteBuffer(commandQueue, gpuNextParticles,    CL_TRUE, 0, n * sizeof(cl_float4), nextParticles, 0, nullptr, nullptr);
-  assert(cpuCopyResult1 == CL_SUCCESS);
-  assert(cpuCopyResult2 == CL_SUCCESS);
-
   cl_int programResult;
   std::string clFile = readFromFile("res/kernels/particle-attraction.cl");
   const char* programSource = clFile.c_str();
@@ -125,51 +126,413 @@ RuntimeOpenCL::RuntimeOpenCL(const std::vector<Particle>& particles) : n(particl
   program = clCreateProgramWithSource(context, 1, &programSource, &programSourceLength, &programResult);
   assert(programResult == CL_SUCCESS);
 
-  cl_int buildResult = clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr);
+  cl_int buildResult = clBuildProgram(program, ids.size(), ids.data(), nullptr, nullptr, nullptr);
   assert(buildResult == CL_SUCCESS);
 
   cl_int kernelResult;
   kernel = clCreateKernel(program, "attraction", &kernelResult);
   assert(kernelResult == CL_SUCCESS);
 
-  cl_int kernelArgResult1 = clSetKernelArg(kernel, 1, sizeof(cl_int), &n);
-  cl_int kernelArgResult2 = clSetKernelArg(kernel, 2, sizeof(cl_mem), &gpuCurrentParticles);
-  cl_int kernelArgResult3 = clSetKernelArg(kernel, 3, sizeof(cl_mem), &gpuNextParticles);
-  assert(kernelArgResult1 == CL_SUCCESS);
-  assert(kernelArgResult2 == CL_SUCCESS);
-  assert(kernelArgResult3 == CL_SUCCESS);
+  vertexKernel = clCreateKernel(program, "attractionVertices", &kernelResult);
+  assert(kernelResult == CL_SUCCESS);
+
+  upload(particles);
+}
+
+bool RuntimeOpenCL::isAvailable(bool multiDevice) {
+  cl_platform_id platforms[64];
+  cl_uint platformCount;
+  if (clGetPlatformIDs(64, platforms, &platformCount) != CL_SUCCESS) return false;
+
+  const cl_device_type type = multiDevice ? CL_DEVICE_TYPE_ALL : CL_DEVICE_TYPE_GPU;
+  for (cl_uint i = 0; i < platformCount; i++) {
+    cl_uint deviceCount;
+    if (clGetDeviceIDs(platforms[i], type, 0, nullptr, &deviceCount) == CL_SUCCESS && deviceCount)
+      return true;
+  }
+
+  return false;
 }
 
 RuntimeOpenCL::~RuntimeOpenCL() {
-  clReleaseMemObject(gpuCurrentParticles);
-	clReleaseMemObject(gpuNextParticles);
+  releaseBuffers();
 	clReleaseKernel(kernel);
+  clReleaseKernel(vertexKernel);
 	clReleaseProgram(program);
-	clReleaseCommandQueue(commandQueue);
+  if (slices.empty()) {
+    clReleaseCommandQueue(commandQueue);
+    clReleaseDevice(device);
+  }
+  for (Slice& s : slices) {
+    clReleaseCommandQueue(s.queue);
+    clReleaseDevice(s.device);
+  }
 	clReleaseContext(context);
-	clReleaseDevice(device);
+}
+
+void RuntimeOpenCL::upload(const std::vector<Particle>& particles) {
+  TRACE_SCOPE("upload");
+  nb::Clock clock;
+
+  // Merging, insertion and removal change the body count, most of the time it still fits
+  n = particles.size();
+  if (!currentParticles || n > capacity || (n < capacity / 4 && capacity > MIN_CAPACITY)) {
+    releaseBuffers();
+    capacity = std::max(n > capacity ? std::max(n, capacity * 2) : n * 2, static_cast<uint32_t>(MIN_CAPACITY));
+    createBuffers();
+  } else if (mappedVertices) {
+    clEnqueueUnmapMemObject(commandQueue, gpuVertices, mappedVertices, 0, nullptr, nullptr);
+    mappedVertices = nullptr;
+  }
+  clFinish(commandQueue);
+
+  // Quads as the particles have them, the kernel only moves their positions
+  for (uint32_t i = 0; i < n; i++) {
+    const Particle& p = particles[i];
+    currentParticles[i] = {
+      p.getPosition().x,
+      p.getPosition().y,
+      p.getVelocity().x,
+      p.getVelocity().y
+    };
+    masses[i] = p.getMass();
+    radii[i] = p.getRadius();
+    std::copy(p.getVertices(), p.getVertices() + 4, vertices + i * 4);
+  }
+
+  cl_int cpuCopyResult1 = clEnqueueWriteBuffer(commandQueue, gpuCurrentParticles, CL_FALSE, 0, n * sizeof(cl_float4), currentParticles, 0, nullptr, nullptr);
+  cl_int cpuCopyResult2 = clEnqueueWriteBuffer(commandQueue, gpuMasses, CL_FALSE, 0, n * sizeof(cl_float), masses, 0, nullptr, nullptr);
+  assert(cpuCopyResult1 == CL_SUCCESS);
+  assert(cpuCopyResult2 == CL_SUCCESS);
 
-  delete currentParticles;
-  delete nextParticles;
+  if (!slices.empty()) {
+    // The other queues only read the shared buffers once they are complete
+    clFinish(commandQueue);
+    partition();
+    uploadSeconds.observe(clock.getElapsedTime().asSeconds());
+    return;
+  }
+
+  cl_int cpuCopyResult3 = clEnqueueWriteBuffer(commandQueue, gpuRadii, CL_FALSE, 0, n * sizeof(cl_float), radii, 0, nullptr, nullptr);
+  // From the buffer's own host pointer, which the spec allows once it holds the latest bits
+  cl_int cpuCopyResult4 = clEnqueueWriteBuffer(commandQueue, gpuVertices, CL_TRUE, 0, n * 4 * sizeof(nb::Vertex), vertices, 0, nullptr, nullptr);
+  assert(cpuCopyResult3 == CL_SUCCESS);
+  assert(cpuCopyResult4 == CL_SUCCESS);
+  uploadSeconds.observe(clock.getElapsedTime().asSeconds());
 }
 
-void RuntimeOpenCL::run(const float& dt) {
-  const size_t globalWorkSize = n;
-  const size_t localWorkSize = maxLocalSize;
+void RuntimeOpenCL::download(std::vector<Particle>& particles) {
+  TRACE_SCOPE("download");
+  assert(particles.size() == n);
+
+  nb::Clock clock;
+  clEnqueueReadBuffer(commandQueue, gpuCurrentParticles, CL_TRUE, 0, n * sizeof(cl_float4), nextParticles, 0, nullptr, nullptr);
+  downloadSeconds.observe(clock.getElapsedTime().asSeconds());
+  apply(particles);
+}
+
+void RuntimeOpenCL::run(const float& dt, const float& softening, std::vector<Particle>& particles) {
+  if (!slices.empty()) {
+    runSlices(dt, softening);
+    apply(particles);
+    return;
+  }
+
+  {
+    TRACE_SCOPE("clEnqueueNDRangeKernel");
+    enqueue(kernel, dt, softening);
+  }
+  {
+    TRACE_SCOPE("clEnqueueReadBuffer");
+    nb::Clock clock;
+    clEnqueueReadBuffer(commandQueue, gpuNextParticles, CL_TRUE, 0, n * sizeof(cl_float4), nextParticles, 0, nullptr, nullptr);
+    downloadSeconds.observe(clock.getElapsedTime().asSeconds());
+  }
 
-  clSetKernelArg(kernel, 0, sizeof(cl_float), &dt);
-  clSetKernelArg(kernel, 2, sizeof(cl_mem), &gpuCurrentParticles);
-  clSetKernelArg(kernel, 3, sizeof(cl_mem), &gpuNextParticles);
+  std::swap(gpuCurrentParticles, gpuNextParticles);
+  apply(particles);
+}
 
-  clEnqueueNDRangeKernel(commandQueue, kernel, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, nullptr);
-  clEnqueueReadBuffer(commandQueue, gpuNextParticles, CL_TRUE, 0, n * sizeof(cl_float4), nextParticles, 0, nullptr, nullptr);
+void RuntimeOpenCL::runVertices(const float& dt, const float& softening) {
+  if (!slices.empty()) {
+    runSlices(dt, softening);
+
+    // The slices only bring the bodies back, their quads are moved here
+    for (uint32_t i = 0; i < n; i++) {
+      const float x = nextParticles[i].x, y = nextParticles[i].y, r = radii[i];
+      nb::Vertex* quad = vertices + i * 4;
+      quad[0].position = {x - r, y - r};
+      quad[1].position = {x + r, y - r};
+      quad[2].position = {x + r, y + r};
+      quad[3].position = {x - r, y + r};
+    }
+    return;
+  }
+
+  // The device may not write the buffer while the host has it mapped
+  if (mappedVertices) {
+    clEnqueueUnmapMemObject(commandQueue, gpuVertices, mappedVertices, 0, nullptr, nullptr);
+    mappedVertices = nullptr;
+  }
+
+  {
+    TRACE_SCOPE("clEnqueueNDRangeKernel");
+    clSetKernelArg(vertexKernel, 6, sizeof(cl_mem), &gpuRadii);
+    clSetKernelArg(vertexKernel, 7, sizeof(cl_mem), &gpuVertices);
+    enqueue(vertexKernel, dt, softening);
+  }
 
   std::swap(gpuCurrentParticles, gpuNextParticles);
 
+  TRACE_SCOPE("clEnqueueMapBuffer");
+  nb::Clock clock;
+  cl_int mapResult;
+  mappedVertices = static_cast<nb::Vertex*>(clEnqueueMapBuffer(
+    commandQueue, gpuVertices, CL_TRUE, CL_MAP_READ, 0, n * 4 * sizeof(nb::Vertex), 0, nullptr, nullptr, &mapResult
+  ));
+  downloadSeconds.observe(clock.getElapsedTime().asSeconds());
+  assert(mapResult == CL_SUCCESS);
+}
+
+const nb::Vertex* RuntimeOpenCL::getVertices() const {
+  return slices.empty() ? mappedVertices : vertices;
+}
+
+size_t RuntimeOpenCL::getVertexCount() const {
+  return n * 4;
+}
+
+size_t RuntimeOpenCL::getDeviceCount() const {
+  return std::max<size_t>(1, slices.size());
+}
+
+const std::string& RuntimeOpenCL::getDeviceName(size_t device) const {
+  return slices.empty() ? deviceName : slices[device].name;
+}
+
+uint32_t RuntimeOpenCL::getDeviceBodies(size_t device) const {
+  return slices.empty() ? n : slices[device].end - slices[device].begin;
+}
+
+void RuntimeOpenCL::enqueue(cl_kernel k, const float& dt, const float& softening) {
+  // Rounded up to whole work groups, the kernel skips the padding
+  const size_t localWorkSize = maxLocalSize;
+  const size_t globalWorkSize = (n + localWorkSize - 1) / localWorkSize * localWorkSize;
+
+  clSetKernelArg(k, 0, sizeof(cl_float), &dt);
+  clSetKernelArg(k, 1, sizeof(cl_float), &softening);
+  clSetKernelArg(k, 2, sizeof(cl_int), &n);
+  clSetKernelArg(k, 3, sizeof(cl_mem), &gpuMasses);
+  clSetKernelArg(k, 4, sizeof(cl_mem), &gpuCurrentParticles);
+  clSetKernelArg(k, 5, sizeof(cl_mem), &gpuNextParticles);
+
+  clEnqueueNDRangeKernel(commandQueue, k, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, nullptr);
+}
+
+void RuntimeOpenCL::apply(std::vector<Particle>& particles) const {
+  for (uint32_t i = 0; i < n; i++) {
+    particles[i].update({nextParticles[i].x, nextParticles[i].y});
+    particles[i].setVelocity({nextParticles[i].z, nextParticles[i].w});
+  }
+}
+
+void RuntimeOpenCL::createBuffers() {
+  currentParticles = new cl_float4[capacity];
+  nextParticles = new cl_float4[capacity];
+  masses = new cl_float[capacity];
+  radii = new cl_float[capacity];
+  vertices = new nb::Vertex[capacity * 4];
+
+  cl_int gpuMallocResult1;
+  cl_int gpuMallocResult2;
+  cl_int gpuMallocResult3;
+  cl_int gpuMallocResult4;
+  cl_int gpuMallocResult5;
+  gpuCurrentParticles = clCreateBuffer(context, CL_MEM_READ_WRITE, capacity * sizeof(cl_float4), nullptr, &gpuMallocResult1);
+  gpuMasses           = clCreateBuffer(context, CL_MEM_READ_ONLY, capacity * sizeof(cl_float), nullptr, &gpuMallocResult3);
+  assert(gpuMallocResult1 == CL_SUCCESS);
+  assert(gpuMallocResult3 == CL_SUCCESS);
+
+  // Every device writes a next buffer of its own, the quads are moved on the host
+  if (!slices.empty()) {
+    for (Slice& s : slices) {
+      s.next = clCreateBuffer(context, CL_MEM_WRITE_ONLY, capacity * sizeof(cl_float4), nullptr, &gpuMallocResult2);
+      assert(gpuMallocResult2 == CL_SUCCESS);
+    }
+    return;
+  }
+
+  gpuNextParticles    = clCreateBuffer(context, CL_MEM_READ_WRITE, capacity * sizeof(cl_float4), nullptr, &gpuMallocResult2);
+  gpuRadii            = clCreateBuffer(context, CL_MEM_READ_ONLY, capacity * sizeof(cl_float), nullptr, &gpuMallocResult4);
+
+  // Host pointer so integrated GPUs write straight into what SFML draws, discrete ones copy it on map
+  gpuVertices = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, capacity * 4 * sizeof(nb::Vertex), vertices, &gpuMallocResult5);
+  assert(gpuMallocResult2 == CL_SUCCESS);
+  assert(gpuMallocResult4 == CL_SUCCESS);
+  assert(gpuMallocResult5 == CL_SUCCESS);
+}
+
+void RuntimeOpenCL::releaseBuffers() {
+  if (!currentParticles) return;
+
+  if (mappedVertices) clEnqueueUnmapMemObject(commandQueue, gpuVertices, mappedVertices, 0, nullptr, nullptr);
+  mappedVertices = nullptr;
   clFinish(commandQueue);
+
+  clReleaseMemObject(gpuCurrentParticles);
+  clReleaseMemObject(gpuMasses);
+  if (slices.empty()) {
+    clReleaseMemObject(gpuNextParticles);
+    clReleaseMemObject(gpuRadii);
+    clReleaseMemObject(gpuVertices);
+  }
+  for (Slice& s : slices) clReleaseMemObject(s.next);
+
+  delete[] currentParticles;
+  delete[] nextParticles;
+  delete[] masses;
+  delete[] radii;
+  delete[] vertices;
+  currentParticles = nullptr;
 }
 
-const cl_float4* RuntimeOpenCL::getComputedParticlesPtr() const {
-  return nextParticles;
+void RuntimeOpenCL::selectDevices(uint32_t subDeviceUnits) {
+  cl_platform_id platforms[64];
+  cl_uint platformCount;
+  clGetPlatformIDs(64, platforms, &platformCount);
+
+  // A context can not span platforms, the one with the most devices after the split is used
+  std::vector<cl_device_id> best;
+  for (cl_uint i = 0; i < platformCount; i++) {
+    cl_device_id devices[64];
+    cl_uint deviceCount;
+    if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 64, devices, &deviceCount) != CL_SUCCESS) continue;
+
+    std::vector<cl_device_id> found;
+    for (cl_uint j = 0; j < deviceCount; j++) {
+      const cl_device_partition_property equally[] = {CL_DEVICE_PARTITION_EQUALLY, subDeviceUnits, 0};
+      cl_device_id subDevices[64];
+      cl_uint subDeviceCount = 0;
+      if (subDeviceUnits && clCreateSubDevices(devices[j], equally, 64, subDevices, &subDeviceCount) == CL_SUCCESS)
+        found.insert(found.end(), subDevices, subDevices + subDeviceCount);
+      else
+        found.push_back(devices[j]);
+    }
+
+    // Releasing a root device does nothing, sub-devices are freed
+    std::vector<cl_device_id>& unused = found.size() > best.size() ? best : found;
+    for (cl_device_id d : unused) clReleaseDevice(d);
+    if (found.size() > best.size()) best.swap(found);
+  }
+
+  for (cl_device_id d : best) {
+    char name[256] = "";
+    cl_uint units = 0;
+    clGetDeviceInfo(d, CL_DEVICE_NAME, sizeof(name), name, nullptr);
+    clGetDeviceInfo(d, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, nullptr);
+
+    Slice s{};
+    s.device = d;
+    s.name = std::string(name) + " #" + std::to_string(slices.size()) + " (" + std::to_string(units) + " units)";
+    slices.push_back(s);
+    printf("Device %s\n", s.name.c_str());
+  }
+  printf("\n");
+
+  if (!slices.empty()) device = slices[0].device;
 }
 
+void RuntimeOpenCL::runSlices(const float& dt, const float& softening) {
+  {
+    TRACE_SCOPE("clEnqueueNDRangeKernel");
+    clSetKernelArg(kernel, 0, sizeof(cl_float), &dt);
+    clSetKernelArg(kernel, 1, sizeof(cl_float), &softening);
+    clSetKernelArg(kernel, 2, sizeof(cl_int), &n);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), &gpuMasses);
+    clSetKernelArg(kernel, 4, sizeof(cl_mem), &gpuCurrentParticles);
+
+    // Arguments are captured by every enqueue, the one kernel serves all the queues. The work offset makes the ids
+    // those of the bodies, the rounding up to whole groups spills into the next slice where nothing reads it back.
+    for (Slice& s : slices) {
+      if (s.begin == s.end) continue;
+
+      const size_t offset = s.begin;
+      const size_t globalWorkSize = (s.end - s.begin + s.localSize - 1) / s.localSize * s.localSize;
+      clSetKernelArg(kernel, 5, sizeof(cl_mem), &s.next);
+      clEnqueueNDRangeKernel(s.queue, kernel, 1, &offset, &globalWorkSize, &s.localSize, 0, nullptr, &s.kernelDone);
+      clEnqueueReadBuffer(s.queue, s.next, CL_FALSE, s.begin * sizeof(cl_float4), (s.end - s.begin) * sizeof(cl_float4),
+                          nextParticles + s.begin, 0, nullptr, &s.readDone);
+      clFlush(s.queue);
+    }
+  }
+
+  {
+    TRACE_SCOPE("clWaitForEvents");
+    nb::Clock clock;
+    std::vector<cl_event> reads;
+    for (const Slice& s : slices)
+      if (s.readDone) reads.push_back(s.readDone);
+    clWaitForEvents(reads.size(), reads.data());
+    downloadSeconds.observe(clock.getElapsedTime().asSeconds());
+  }
+
+  // The gathered bodies are what every device reads next step
+  clEnqueueWriteBuffer(commandQueue, gpuCurrentParticles, CL_TRUE, 0, n * sizeof(cl_float4), nextParticles, 0, nullptr, nullptr);
+
+  balance();
+  partition();
+  if (++steps % OPENCL_REPORT_INTERVAL == 0) report();
+}
+
+void RuntimeOpenCL::balance() {
+  for (Slice& s : slices) {
+    if (!s.kernelDone) continue;
+
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(s.kernelDone, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+    clGetEventProfilingInfo(s.kernelDone, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+    clReleaseEvent(s.kernelDone);
+    clReleaseEvent(s.readDone);
+    s.kernelDone = s.readDone = nullptr;
+
+    if (end <= start) continue;
+    const double speed = (s.end - s.begin) / ((end - start) * 1e-9);
+    s.speed = s.speed == 0.0 ? speed : s.speed + (speed - s.speed) * OPENCL_BALANCE_SMOOTHING;
+  }
+}
+
+void RuntimeOpenCL::partition() {
+  // Devices not measured yet count as fast as the average of the others, as equals when none is
+  double measured = 0.0;
+  uint32_t measuredCount = 0;
+  for (const Slice& s : slices) {
+    if (s.speed > 0.0) {
+      measured += s.speed;
+      measuredCount++;
+    }
+  }
+  const double unmeasured = measuredCount ? measured / measuredCount : 1.0;
+
+  std::vector<double> speeds;
+  double total = 0.0;
+  for (const Slice& s : slices) {
+    speeds.push_back(s.speed > 0.0 ? s.speed : unmeasured);
+    total += speeds.back();
+  }
+
+  double cumulative = 0.0;
+  uint32_t begin = 0;
+  for (size_t i = 0; i < slices.size(); i++) {
+    cumulative += speeds[i];
+    slices[i].begin = begin;
+    slices[i].end = i == slices.size() - 1 ? n : static_cast<uint32_t>(n * (cumulative / total));
+    begin = slices[i].end;
+  }
+}
+
+void RuntimeOpenCL::report() const {
+  printf("OpenCL slices:");
+  for (const Slice& s : slices)
+    printf(" %s %u bodies at %.3g/s,", s.name.c_str(), s.end - s.begin, s.speed);
+  printf("\n");
+}
@@ -1,25 +1,78 @@
 #include <stdint.h>
+#include <string>
 #include <vector>
 
 #include "CL/opencl.h"
 #include "../Particle.hpp"
 
+// Direct sum on the device. The host particles stay the state of record, the device holds a copy
+// taken by upload that only comes back through run or download.
+//
+// With multiple devices every device of the platform that has the most takes part, each with a queue of its own.
+// They all read the bodies from buffers shared through the context and integrate a slice of them, sized after how
+// fast the device ran its last slices. The slices are read back asynchronously and the gathered bodies are the
+// shared input of the next step.
 class RuntimeOpenCL {
   public:
-    RuntimeOpenCL(const std::vector<Particle>& particles);
+    // Sub-device units splits the devices into sub-devices of that many compute units when they can be, 0 keeps
+    // them whole. Only used with multiple devices.
+    RuntimeOpenCL(const std::vector<Particle>& particles, bool multiDevice = OPENCL_MULTI_DEVICE,
+                  uint32_t subDeviceUnits = OPENCL_SUB_DEVICE_UNITS);
     ~RuntimeOpenCL();
 
-    [[nodiscard]]
-    const cl_float4* getComputedParticlesPtr() const;
+    // Whether some platform has a GPU, or any device at all with multiple devices. The constructor asserts there is one.
+    static bool isAvailable(bool multiDevice = OPENCL_MULTI_DEVICE);
 
-    void run(const float& dt);
+    // Positions, velocities, masses and quads. The buffers double when the bodies outgrow them and are cut to twice
+    // the bodies once a quarter full, the kernels only ever see the body count.
+    void upload(const std::vector<Particle>& particles);
+
+    // Positions and velocities of the last step back into the particles
+    void download(std::vector<Particle>& particles);
+
+    // Step whose result is read back into the particles right away
+    void run(const float& dt, const float& softening, std::vector<Particle>& particles);
+
+    // Step that leaves the particles on the device and writes their quads into a host-mapped buffer instead
+    void runVertices(const float& dt, const float& softening);
+
+    // Quads of the last runVertices in the layout SFML draws, valid until the next run
+    [[nodiscard]] const nb::Vertex* getVertices() const;
+    [[nodiscard]] size_t getVertexCount() const;
+
+    // 1 with a single device
+    [[nodiscard]] size_t getDeviceCount() const;
+    [[nodiscard]] const std::string& getDeviceName(size_t device) const;
+    [[nodiscard]] uint32_t getDeviceBodies(size_t device) const; // Integrated by it in the last step
 
   private:
-    const uint32_t n;
-    cl_float4* currentParticles;
-    cl_float4* nextParticles;
+    // Device of the multiple device mode, the bodies [begin, end) of a step are its own
+    struct Slice {
+      cl_device_id device;
+      cl_command_queue queue; // Profiled, the kernel times set the slice sizes
+      std::string name;
+      size_t localSize;
+      cl_mem next = nullptr;  // Whole, only the slice is written and read back
+      uint32_t begin = 0, end = 0;
+      double speed = 0.0;     // Bodies per second of kernel time, smoothed, 0 until measured
+      cl_event kernelDone = nullptr;
+      cl_event readDone = nullptr;
+    };
+
+    std::vector<Slice> slices; // Empty with a single device
+    uint32_t steps = 0;
 
-    cl_device_id device = nullptr;
+    uint32_t n = 0;
+    uint32_t capacity = 0;                 // Bodies the buffers hold
+    cl_float4* currentParticles = nullptr; // Staging of upload
+    cl_float4* nextParticles = nullptr;    // Staging of run and download
+    cl_float* masses = nullptr;
+    cl_float* radii = nullptr;
+    nb::Vertex* vertices = nullptr;        // Backs gpuVertices, colors and texture coordinates are only set here
+    nb::Vertex* mappedVertices = nullptr;
+
+    cl_device_id device = nullptr;         // The first one with multiple devices
+    std::string deviceName;
     size_t maxLocalSize;
     size_t maxDimensions;
 
@@ -28,8 +81,23 @@ class RuntimeOpenCL {
 
     cl_mem gpuCurrentParticles;
     cl_mem gpuNextParticles;
+    cl_mem gpuMasses;
+    cl_mem gpuRadii;
+    cl_mem gpuVertices;
 
     cl_kernel kernel;
+    cl_kernel vertexKernel;
     cl_program program;
-};
 
+  private:
+    void enqueue(cl_kernel k, const float& dt, const float& softening);
+    void apply(std::vector<Particle>& particles) const;
+    void createBuffers();
+    void releaseBuffers();
+
+    void selectDevices(uint32_t subDeviceUnits);
+    void runSlices(const float& dt, const float& softening);
+    void balance();   // Speeds from the last step
+    void partition(); // Slices from the speeds
+    void report() const;
+};
@@ -1,26 +1,16 @@
 // http://arborjs.org/docs/barnes-hut
 
 #include <algorithm>
-#include <cassert>
 #include <cmath>
 #include <cstdio>
-#include <format>
-#include <stdexcept>
 
 #include "quadtree.hpp"
 
 using namespace qt;
 
-uint32_t Node::maxDepth = 0;
+#define NODE_HEADER alignof(std::max_align_t) // Room for the arena a node came from
 
-inline float mag(const sf::Vector2f& v1, const sf::Vector2f& v2) {
-  sf::Vector2f v = v1 - v2;
-  return sqrtf(v.x * v.x + v.y * v.y);
-}
-
-inline bool isFar(float s, float d) {
-  return s / (d + ZERO_DIVISION_PREVENT_VALUE) < QUAD_TREE_THETA;
-}
+std::atomic<uint32_t> Node::maxDepth = 0;
 
 Rectangle::Rectangle(float x, float y, float w, float h)
   : x(x), y(y), w(w), h(h),
@@ -47,10 +37,19 @@ bool Rectangle::intersects(const Rectangle& r) const {
   );
 }
 
+float Rectangle::distanceTo(const nb::Vector2f& p) const {
+  float dx = std::max({left - p.x, 0.f, p.x - right});
+  float dy = std::max({top - p.y, 0.f, p.y - bottom});
+
+  return sqrtf(dx * dx + dy * dy);
+}
+
 Node::Node(Rectangle boundary, uint32_t depth)
-  : boundary(boundary), depth(depth) {
+  : boundary(boundary), depth(depth), subtreeDepth(depth) {
   gravity = {{boundary.x, boundary.y}, 0.f};
-  maxDepth = std::max(maxDepth, depth);
+
+  uint32_t reached = maxDepth.load(std::memory_order_relaxed);
+  while (reached < depth && !maxDepth.compare_exchange_weak(reached, depth, std::memory_order_relaxed));
 }
 
 Node::~Node() {
@@ -60,129 +59,205 @@ Node::~Node() {
   delete southEast;
 }
 
+void* Node::operator new(size_t size) {
+  Arena* arena = Arena::current();
+  void* block = arena ? arena->allocate(size + NODE_HEADER) : ::operator new(size + NODE_HEADER);
+  *static_cast<Arena**>(block) = arena;
+
+  return static_cast<char*>(block) + NODE_HEADER;
+}
+
+void Node::operator delete(void* p) {
+  void* block = static_cast<char*>(p) - NODE_HEADER;
+  if (!*static_cast<Arena**>(block))
+    ::operator delete(block);
+}
+
 void Node::printMaxReachedDepth() {
-  printf("Maximum reached depth: %d\n", maxDepth);
-}
-
-bool Node::insert(const Particle* p) {
-  // Check if particle is within boundaries
-  if (!boundary.contains(p)) return false;
-
-  // 1. If this node does not reached the container limit or exceeded the depth limit, put the new particle here
-  // REVIEW: Possible without depth limit?
-  if (container.size() < QUAD_TREE_CONTAINER_LIMIT || depth >= QUAD_TREE_MAX_DEPTH) {
-
-    // 2. If this node is an internal (divided) node, update the gravity field.
-    // Recursively insert the particles in the appropriate quadrant
-    if (northWest) {
-      gravity.update(p->getPosition(), p->getMass());
-
-      return
-        northWest->insert(p) ||
-        northEast->insert(p) ||
-        southWest->insert(p) ||
-        southEast->insert(p);
-
-    } else {
-      container.push_back(p);
-      return true;
-    }
-
-  // 3. If this node is an external node (which already containing other particle),
-  // subdivide the region and recursively insert the particles into the appropriate quadrants
-  } else {
-    subdivide(p);
-    return true;
+  printf("Maximum reached depth: %u\n", maxDepth.load());
+}
+
+void Node::split(uint32_t levels, std::vector<Node*>& leaves) {
+  if (depth == levels) {
+    leaves.push_back(this);
+    return;
   }
 
-  throw std::runtime_error(std::format("A particle wasn't inserted, depth: {}\n", depth));
+  const float& x = boundary.x;
+  const float& y = boundary.y;
+  float wHalf = boundary.w * 0.5f;
+  float hHalf = boundary.h * 0.5f;
+
+  northWest = new Node(Rectangle(x - wHalf, y - hHalf, wHalf, hHalf), depth + 1);
+  northEast = new Node(Rectangle(x + wHalf, y - hHalf, wHalf, hHalf), depth + 1);
+  southWest = new Node(Rectangle(x - wHalf, y + hHalf, wHalf, hHalf), depth + 1);
+  southEast = new Node(Rectangle(x + wHalf, y + hHalf, wHalf, hHalf), depth + 1);
+
+  northWest->split(levels, leaves);
+  northEast->split(levels, leaves);
+  southWest->split(levels, leaves);
+  southEast->split(levels, leaves);
 }
 
-void Node::solveAttraction(Particle* p2) {
-  // 1. If this node is an external,
-  // try to calculate the force on the particle by other particles (if have any and not the same).
-  if (!northWest) {
-    for (const Particle* p1 : container)
-      if (p2 != p1)
-        p2->attractTo(p1->getPosition(), p1->getMass());
-
-  // 2. Otherwise, calculate the ration s/d. If s/d < θ,
-  // treat this internal node as a single body, and calculate the force for the particle.
-  } else if (isFar(boundary.w * 2.f, mag(p2->getPosition(), gravity.center)))
-    p2->attractTo(gravity.center, gravity.mass);
-
-  // 3. Otherwise, run the procedure recursively for other nodes
-  else {
-    northWest->solveAttraction(p2);
-    northEast->solveAttraction(p2);
-    southWest->solveAttraction(p2);
-    southEast->solveAttraction(p2);
+int Node::ownerIndex(const Particle* p, uint32_t levels) const {
+  if (!boundary.contains(p)) return -1;
+
+  // Same quadrant rule as insert, so particles on the edges go where insert would put them
+  int index = 0;
+  const Node* node = this;
+  while (node->depth < levels) {
+    const Node* child = node->quadrant(p);
+    index = index * 4 + (child == node->northWest ? 0 : child == node->northEast ? 1 : child == node->southWest ? 2 : 3);
+    node = child;
   }
+
+  return index;
 }
 
-void Node::show(sf::RenderTarget& target, const uint32_t& depthLimit) {
-  static const sf::Color color = sf::Color(30, 30, 30);
+Node* Node::quadrant(const Particle* p) const {
+  bool east = p->getPosition().x >= boundary.x;
+  bool south = p->getPosition().y >= boundary.y;
 
-  sf::VertexArray rect(sf::LinesStrip, 4);
-  rect[0] = sf::Vertex({boundary.left , boundary.top}, color);
-  rect[1] = sf::Vertex({boundary.right, boundary.top}, color);
-  rect[2] = sf::Vertex({boundary.right, boundary.bottom}, color);
-  rect[3] = sf::Vertex({boundary.left , boundary.bottom}, color);
-  target.draw(rect);
+  return south ? (east ? southEast : southWest) : (east ? northEast : northWest);
+}
 
-  if (northWest && depth <= depthLimit) {
-    northWest->show(target, depthLimit);
-    northEast->show(target, depthLimit);
-    southWest->show(target, depthLimit);
-    southEast->show(target, depthLimit);
+void Node::collectLevel(uint32_t levels, std::vector<Node*>& nodes) {
+  if (depth == levels || !northWest) {
+    nodes.push_back(this);
+    return;
   }
+
+  northWest->collectLevel(levels, nodes);
+  northEast->collectLevel(levels, nodes);
+  southWest->collectLevel(levels, nodes);
+  southEast->collectLevel(levels, nodes);
 }
 
-void Node::Gravity::update(const sf::Vector2f& pos, const float& m2) {
-  float& m1 = mass;
-  float& x = center.x;
-  float& y = center.y;
-  float m = m1 + m2;
-  assert(m != 0.f);
+void Node::gatherGravity(uint32_t levels) {
+  // The nodes collectLevel returned have their moments already
+  if (depth == levels || !northWest) return;
 
-  x = (x * m1 + pos.x * m2) / m;
-  y = (y * m1 + pos.y * m2) / m;
-  m1 = m;
+  northWest->gatherGravity(levels);
+  northEast->gatherGravity(levels);
+  southWest->gatherGravity(levels);
+  southEast->gatherGravity(levels);
+  combineChildren();
 }
 
-void Node::subdivide(const Particle* p2) {
-  const float& x = boundary.x;
-  const float& y = boundary.y;
-  float wHalf = boundary.w * 0.5f;
-  float hHalf = boundary.h * 0.5f;
+void Node::refit() {
+  if (northWest) {
+    northWest->refit();
+    northEast->refit();
+    southWest->refit();
+    southEast->refit();
+    combineChildren();
+    return;
+  }
 
-  Rectangle nwRect(x - wHalf, y - hHalf, wHalf, hHalf);
-  Rectangle neRect(x + wHalf, y - hHalf, wHalf, hHalf);
-  Rectangle swRect(x - wHalf, y + hHalf, wHalf, hHalf);
-  Rectangle seRect(x + wHalf, y + hHalf, wHalf, hHalf);
-
-  northWest = new Node(nwRect, depth + 1);
-  northEast = new Node(neRect, depth + 1);
-  southWest = new Node(swRect, depth + 1);
-  southEast = new Node(seRect, depth + 1);
-
-  // Reallocate this (node) particles
-  for (const Particle* p1 : container) {
-    northWest->insert(p1) ||
-    northEast->insert(p1) ||
-    southWest->insert(p1) ||
-    southEast->insert(p1);
-    gravity.update(p1->getPosition(), p1->getMass());
+  // Sums in double, a leaf at the depth limit may hold a lot of bodies
+  double mass = 0.0, x = 0.0, y = 0.0;
+  spread = 0.f;
+  for (const Particle* p : container) {
+    const nb::Vector2f& pos = p->getPosition();
+    mass += p->getMass();
+    x += p->getMass() * pos.x;
+    y += p->getMass() * pos.y;
+    spread = std::max(spread, boundary.distanceTo(pos));
   }
 
-  // Insert the new particle
-  northWest->insert(p2) ||
-  northEast->insert(p2) ||
-  southWest->insert(p2) ||
-  southEast->insert(p2);
+  gravity.mass = mass;
+  gravity.center = mass > 0.0 ? nb::Vector2f(x / mass, y / mass) : nb::Vector2f(boundary.x, boundary.y);
+  subtreeNodes = 1;
+  subtreeDepth = depth;
 
-  gravity.update(p2->getPosition(), p2->getMass());
+  bmax = 0.f;
+  for (const Particle* p : container)
+    bmax = std::max(bmax, mag(p->getPosition(), gravity.center));
+}
+
+void Node::combineChildren() {
+  double mass = 0.0, x = 0.0, y = 0.0;
+  spread = 0.f;
+  subtreeNodes = 1;
+  subtreeDepth = depth;
+  for (const Node* child : {northWest, northEast, southWest, southEast}) {
+    const Gravity& g = child->gravity;
+    mass += g.mass;
+    x += static_cast<double>(g.mass) * g.center.x;
+    y += static_cast<double>(g.mass) * g.center.y;
+    spread = std::max(spread, child->spread);
+    subtreeNodes += child->subtreeNodes;
+    subtreeDepth = std::max(subtreeDepth, child->subtreeDepth);
+  }
+
+  gravity.mass = mass;
+  gravity.center = mass > 0.0 ? nb::Vector2f(x / mass, y / mass) : nb::Vector2f(boundary.x, boundary.y);
+
+  bmax = 0.f;
+  for (const Node* child : {northWest, northEast, southWest, southEast})
+    if (child->gravity.mass > 0.f)
+      bmax = std::max(bmax, child->bmax + mag(child->gravity.center, gravity.center));
+}
+
+const std::list<const Particle*>& Node::bodies() const {
+  return container;
+}
 
-  container.clear();
+float Node::readDistance(float reach) const {
+  if (depth == 0) return INFINITY;
+  return boundary.w * 4.f * reach + spread * 2.f; // The parent is twice as wide
+}
+
+void Node::collectLeaves(std::vector<const Node*>& leaves) const {
+  if (!northWest) {
+    if (!container.empty()) leaves.push_back(this);
+    return;
+  }
+
+  northWest->collectLeaves(leaves);
+  northEast->collectLeaves(leaves);
+  southWest->collectLeaves(leaves);
+  southEast->collectLeaves(leaves);
+}
+
+void Node::countNodes(uint32_t& nodes, uint32_t& deepest) const {
+  nodes += subtreeNodes;
+  deepest = std::max(deepest, subtreeDepth);
+}
+
+nb::FloatRect Node::bodyBounds() const {
+  nb::Vector2f min = container.front()->getPosition(), max = min;
+  for (const Particle* p : container) {
+    min = {std::min(min.x, p->getPosition().x), std::min(min.y, p->getPosition().y)};
+    max = {std::max(max.x, p->getPosition().x), std::max(max.y, p->getPosition().y)};
+  }
+
+  return {min.x, min.y, max.x - min.x, max.y - min.y};
+}
+
+size_t Node::bodyCount() const {
+  return container.size();
+}
+
+bool Node::contains(const Particle* p) const {
+  return boundary.contains(p);
+}
+
+bool Node::isFarFrom(const Rectangle& bounds, float theta) const {
+  float s = boundary.w * 2.f + spread * 2.f;
+  float d = bounds.distanceTo(gravity.center);
+
+  return d > 0.f && s / d < theta;
+}
+
+void Node::collectBoundaries(uint32_t depthLimit, std::vector<nb::FloatRect>& rects) const {
+  rects.push_back({boundary.left, boundary.top, boundary.right - boundary.left, boundary.bottom - boundary.top});
+
+  if (northWest && depth <= depthLimit) {
+    northWest->collectBoundaries(depthLimit, rects);
+    northEast->collectBoundaries(depthLimit, rects);
+    southWest->collectBoundaries(depthLimit, rects);
+    southEast->collectBoundaries(depthLimit, rects);
+  }
 }
 
@@ -1,9 +1,48 @@
 #pragma once
 
-#include "Particle.hpp"
+#include <atomic>
+#include <cmath>
 #include <list>
+#include <vector>
+
+#include "Particle.hpp"
 
 namespace qt {
+  // When a node may stand in for its bodies. Geometric compares its width to the distance, Bmax the distance from
+  // its center of mass to its farthest body instead. Acceleration bounds the error of the node against the body's
+  // previous acceleration, theta being that relative tolerance.
+  enum class Opening { Geometric, Bmax, Acceleration };
+
+  // Compile-time tuning parameters of the tree and the interaction kernel
+  template<uint32_t ContainerLimit, float Theta, float Softening, Opening Criterion = Opening::Geometric>
+  struct Tuning {
+    static constexpr uint32_t containerLimit = ContainerLimit;
+    static constexpr float theta = Theta;
+    static constexpr float softening = Softening;
+    static constexpr Opening opening = Criterion;
+
+    // Theta of the geometric tests made for whole groups of bodies, which have no acceleration of their own
+    static constexpr float groupTheta = Criterion == Opening::Acceleration ? QUAD_TREE_THETA : Theta;
+
+    // Farthest a body may be from a node it opens, in sizes of the node, its diagonal included. The relative
+    // criterion has no bound, a body with a small enough acceleration opens anything.
+    static constexpr float reach =
+      Criterion == Opening::Geometric ? 1.f / Theta + 1.41421356f :
+      Criterion == Opening::Bmax ? 2.f * 1.41421356f / Theta + 1.41421356f : INFINITY;
+  };
+
+  using DefaultTuning = Tuning<QUAD_TREE_CONTAINER_LIMIT, QUAD_TREE_THETA, ZERO_DIVISION_PREVENT_VALUE>;
+
+  inline float mag(const nb::Vector2f& v1, const nb::Vector2f& v2) {
+    nb::Vector2f v = v1 - v2;
+    return sqrtf(v.x * v.x + v.y * v.y);
+  }
+
+  template<class T>
+  inline bool isFar(float s, float d) {
+    return s / (d + T::softening) < T::theta;
+  }
+
   class Rectangle {
     friend class Node;
 
@@ -13,6 +52,7 @@ namespace qt {
 
       bool contains(const Particle* p) const;
       bool intersects(const Rectangle& r) const;
+      float distanceTo(const nb::Vector2f& p) const; // 0 if inside
 
     private:
       const float x, y, w, h; // The width and height are distances from the center to the edges
@@ -24,28 +64,89 @@ namespace qt {
       Node(Rectangle boundary, uint32_t depth = 0);
       ~Node();
 
+      // Nodes created while a thread has a current Arena are placed in it (and not freed one by one)
+      static void* operator new(size_t size);
+      static void operator delete(void* p);
+
+      struct Gravity {
+        nb::Vector2f center;
+        float mass;
+      };
+
       static void printMaxReachedDepth();
 
+      // Inserts only build the structure, the moments come from refit (or gatherGravity) afterwards
+      template<class T = DefaultTuning>
       bool insert(const Particle* p);
 
-      void solveAttraction(Particle* p1);
+      // Insert without the boundary check, for particles routed here by quadrant (as ownerIndex does)
+      template<class T = DefaultTuning>
+      void place(const Particle* p);
 
-      // The deeper Quadtree the more time to draw the grid
-      void show(sf::RenderTarget& target, const uint32_t& depthLimit);
+      // Parallel construction: split the top levels, fill the leaves independently, then gather their gravity.
+      // The leaves are listed in the order of ownerIndex.
+      void split(uint32_t levels, std::vector<Node*>& leaves);
+      int ownerIndex(const Particle* p, uint32_t levels) const; // -1 if outside
 
-    private:
-      static uint32_t maxDepth;
+      // Parallel moments: refit the nodes at levels (and the leaves above) independently, then gather the ones above
+      void collectLevel(uint32_t levels, std::vector<Node*>& nodes);
+      void gatherGravity(uint32_t levels);
 
-      struct Gravity {
-        sf::Vector2f center;
-        float mass;
-        void update(const sf::Vector2f& pos, const float& m2);
-      };
+      // Number of interactions it took
+      template<class T = DefaultTuning>
+      uint32_t solveAttraction(Particle* p1);
+
+      // Gravitational potential per unit mass at the particle, same traversal as solveAttraction
+      template<class T = DefaultTuning>
+      float solvePotential(const Particle* p1) const;
+
+      // Moments of everything a region needs from this tree: far nodes as a whole, near leaves body by body
+      template<class T = DefaultTuning>
+      void collectEssential(const Rectangle& region, std::vector<Gravity>& out) const;
+
+      // Bottom-up moments of the whole subtree from the current positions, keeping the structure
+      void refit();
+      void collectLeaves(std::vector<const Node*>& leaves) const;
+      void countNodes(uint32_t& nodes, uint32_t& depth) const; // Adds this subtree's nodes, raises depth to its deepest (as of the last refit)
+      [[nodiscard]] nb::FloatRect bodyBounds() const; // Tight around the bodies held directly
+      [[nodiscard]] size_t bodyCount() const;
+      [[nodiscard]] const std::list<const Particle*>& bodies() const;
+
+      // Farthest a body may be from one held by this leaf and still read its position: leaves are summed body by
+      // body once their parent opens, reach as in Tuning. Infinite for a root that is a leaf.
+      [[nodiscard]] float readDistance(float reach) const;
+      [[nodiscard]] bool contains(const Particle* p) const;
+
+      // Whether all of the bounds may take this node as a single mass, counting the bodies that left the boundary since the build
+      [[nodiscard]] bool isFarFrom(const Rectangle& bounds, float theta) const;
+
+      // Opening decisions for all the bodies of a group (in bounds) at once. They are made with a stricter theta,
+      // so they still hold after some drift.
+      template<class T = DefaultTuning>
+      void collectInteractions(const Rectangle& bounds, std::vector<const Node*>& far, std::vector<const Node*>& near) const;
+
+      // Forces on the bodies of this leaf from its interaction list
+      template<class T = DefaultTuning>
+      void solveInteractions(const std::vector<const Node*>& far, const std::vector<const Node*>& near) const;
+
+      // Walks what lies in the viewport: bodies one by one, nodes narrower than minWidth as a single aggregate
+      template<class Body, class Aggregate>
+      void collectVisible(const Rectangle& viewport, float minWidth, Body&& body, Aggregate&& aggregate) const;
+
+      // Boundaries of the nodes down to depthLimit, the deeper the more rectangles the grid draws
+      void collectBoundaries(uint32_t depthLimit, std::vector<nb::FloatRect>& rects) const;
+
+    private:
+      static std::atomic<uint32_t> maxDepth;
 
       std::list<const Particle*> container;
       Gravity gravity;
+      float spread = 0.f; // How far the bodies got past the boundary since the build, kept by refit
+      float bmax = 0.f;   // Farthest body from the center of mass (bounded from the children's), kept by refit
       Rectangle boundary;
       uint32_t depth;
+      uint32_t subtreeNodes = 1; // Counted bottom-up with the moments, so reading the tree's size needs no walk
+      uint32_t subtreeDepth;
 
       Node* northWest = nullptr;
       Node* northEast = nullptr;
@@ -53,7 +154,214 @@ namespace qt {
       Node* southEast = nullptr;
 
     private:
+      template<class T>
       void subdivide(const Particle* p);
+
+      // Whether a body at distance d from the center of mass may take this node as one mass. Without a previous
+      // acceleration (first step, regions) the acceleration criterion falls back to the geometric one.
+      template<class T>
+      bool accepts(float d, float lastAcceleration) const;
+
+      // By the center rather than the children's boundaries, which rounding can leave gaps between
+      Node* quadrant(const Particle* p) const;
+
+      // Moments from the children's, one division per node
+      void combineChildren();
   };
+
+  template<class T>
+  bool Node::insert(const Particle* p) {
+    // Check if particle is within boundaries
+    if (!boundary.contains(p)) return false;
+
+    place<T>(p);
+    return true;
+  }
+
+  template<class T>
+  void Node::place(const Particle* p) {
+    // 1. If this node does not reached the container limit or exceeded the depth limit, put the new particle here
+    // REVIEW: Possible without depth limit?
+    if (container.size() < T::containerLimit || depth >= QUAD_TREE_MAX_DEPTH) {
+
+      // 2. If this node is an internal (divided) node, recursively insert the particle in the appropriate quadrant
+      if (northWest) {
+        quadrant(p)->place<T>(p);
+
+      } else {
+        container.push_back(p);
+      }
+
+    // 3. If this node is an external node (which already containing other particle),
+    // subdivide the region and recursively insert the particles into the appropriate quadrants
+    } else {
+      subdivide<T>(p);
+    }
+  }
+
+  template<class T>
+  uint32_t Node::solveAttraction(Particle* p2) {
+    // 1. If this node is an external,
+    // try to calculate the force on the particle by other particles (if have any and not the same).
+    if (!northWest) {
+      uint32_t interactions = 0;
+      for (const Particle* p1 : container)
+        if (p2 != p1) {
+          p2->attractTo<T::softening>(p1->getPosition(), p1->getMass());
+          interactions++;
+        }
+      return interactions;
+
+    // 2. Otherwise, calculate the ration s/d. If s/d < θ,
+    // treat this internal node as a single body, and calculate the force for the particle.
+    } else if (accepts<T>(mag(p2->getPosition(), gravity.center), p2->getLastAcceleration())) {
+      p2->attractTo<T::softening>(gravity.center, gravity.mass);
+      return 1;
+    }
+
+    // 3. Otherwise, run the procedure recursively for other nodes
+    return
+      northWest->solveAttraction<T>(p2) +
+      northEast->solveAttraction<T>(p2) +
+      southWest->solveAttraction<T>(p2) +
+      southEast->solveAttraction<T>(p2);
+  }
+
+  template<class T>
+  float Node::solvePotential(const Particle* p2) const {
+    float potential = 0.f;
+
+    if (!northWest) {
+      for (const Particle* p1 : container)
+        if (p2 != p1)
+          potential += Particle::potential<T::softening>(p1->getMass(), mag(p2->getPosition(), p1->getPosition()));
+    } else {
+      float d = mag(p2->getPosition(), gravity.center);
+      if (accepts<T>(d, p2->getLastAcceleration()))
+        potential += Particle::potential<T::softening>(gravity.mass, d);
+      else
+        potential +=
+          northWest->solvePotential<T>(p2) +
+          northEast->solvePotential<T>(p2) +
+          southWest->solvePotential<T>(p2) +
+          southEast->solvePotential<T>(p2);
+    }
+
+    return potential;
+  }
+
+  template<class T>
+  void Node::collectEssential(const Rectangle& region, std::vector<Gravity>& out) const {
+    if (!northWest) {
+      for (const Particle* p : container)
+        out.push_back({p->getPosition(), p->getMass()});
+    } else if (accepts<T>(region.distanceTo(gravity.center), 0.f))
+      out.push_back(gravity);
+    else {
+      northWest->collectEssential<T>(region, out);
+      northEast->collectEssential<T>(region, out);
+      southWest->collectEssential<T>(region, out);
+      southEast->collectEssential<T>(region, out);
+    }
+  }
+
+  template<class T>
+  void Node::collectInteractions(const Rectangle& bounds, std::vector<const Node*>& far, std::vector<const Node*>& near) const {
+    if (!northWest) {
+      if (!container.empty()) near.push_back(this);
+      return;
+    }
+
+    if (isFarFrom(bounds, T::groupTheta * (1.f - INTERACTION_LIST_SKIN))) {
+      far.push_back(this);
+      return;
+    }
+
+    northWest->collectInteractions<T>(bounds, far, near);
+    northEast->collectInteractions<T>(bounds, far, near);
+    southWest->collectInteractions<T>(bounds, far, near);
+    southEast->collectInteractions<T>(bounds, far, near);
+  }
+
+  template<class T>
+  void Node::solveInteractions(const std::vector<const Node*>& far, const std::vector<const Node*>& near) const {
+    for (const Particle* body : container) {
+      // The tree only keeps const pointers, the particles themselves belong to the ParticleSystem
+      Particle* p2 = const_cast<Particle*>(body);
+
+      for (const Node* node : far)
+        p2->attractTo<T::softening>(node->gravity.center, node->gravity.mass);
+
+      for (const Node* node : near)
+        for (const Particle* p1 : node->container)
+          if (p2 != p1)
+            p2->attractTo<T::softening>(p1->getPosition(), p1->getMass());
+    }
+  }
+
+  template<class Body, class Aggregate>
+  void Node::collectVisible(const Rectangle& viewport, float minWidth, Body&& body, Aggregate&& aggregate) const {
+    if (!boundary.intersects(viewport)) return;
+
+    if (!northWest) {
+      for (const Particle* p : container)
+        if (viewport.contains(p))
+          body(p);
+    } else if (boundary.w * 2.f < minWidth)
+      aggregate(gravity, boundary.w * 2.f);
+    else {
+      northWest->collectVisible(viewport, minWidth, body, aggregate);
+      northEast->collectVisible(viewport, minWidth, body, aggregate);
+      southWest->collectVisible(viewport, minWidth, body, aggregate);
+      southEast->collectVisible(viewport, minWidth, body, aggregate);
+    }
+  }
+
+  template<class T>
+  bool Node::accepts(float d, float lastAcceleration) const {
+    const float s = boundary.w * 2.f;
+
+    if constexpr (T::opening == Opening::Bmax) {
+      return isFar<T>(bmax * 2.f, d);
+
+    } else if constexpr (T::opening == Opening::Acceleration) {
+      if (lastAcceleration <= 0.f) return s / (d + T::softening) < T::groupTheta;
+
+      // Quadrupole error of the node, G M s^2 / d^4, within theta of the body's acceleration. Bodies close enough
+      // to be among the node's own always open it.
+      float dSq = d * d;
+      return d > bmax && gravity.mass * s * s < T::theta * lastAcceleration * dSq * dSq;
+
+    } else {
+      return isFar<T>(s, d);
+    }
+  }
+
+  template<class T>
+  void Node::subdivide(const Particle* p2) {
+    const float& x = boundary.x;
+    const float& y = boundary.y;
+    float wHalf = boundary.w * 0.5f;
+    float hHalf = boundary.h * 0.5f;
+
+    Rectangle nwRect(x - wHalf, y - hHalf, wHalf, hHalf);
+    Rectangle neRect(x + wHalf, y - hHalf, wHalf, hHalf);
+    Rectangle swRect(x - wHalf, y + hHalf, wHalf, hHalf);
+    Rectangle seRect(x + wHalf, y + hHalf, wHalf, hHalf);
+
+    northWest = new Node(nwRect, depth + 1);
+    northEast = new Node(neRect, depth + 1);
+    southWest = new Node(swRect, depth + 1);
+    southEast = new Node(seRect, depth + 1);
+
+    // Reallocate this (node) particles
+    for (const Particle* p1 : container)
+      quadrant(p1)->place<T>(p1);
+
+    // Insert the new particle
+    quadrant(p2)->place<T>(p2);
+
+    container.clear();
+  }
 }
 
@@ -1,6 +1,57 @@
+#include <cstdlib>
+#include <cstring>
+
 #include "App.hpp"
+#include "Headless.hpp"
+
+int main(int argc, char* argv[]) {
+  // --scaling [max ranks] [bodies] [steps]
+  if (argc > 1 && strcmp(argv[1], "--scaling") == 0)
+    return Headless::scaling(
+      argc > 2 ? atoi(argv[2]) : 8,
+      argc > 3 ? atoi(argv[3]) : INITIAL_PARTICLES,
+      argc > 4 ? atoi(argv[4]) : 100
+    );
+
+  // --numa [bodies] [steps]
+  if (argc > 1 && strcmp(argv[1], "--numa") == 0)
+    return Headless::numa(
+      argc > 2 ? atoi(argv[2]) : INITIAL_PARTICLES,
+      argc > 3 ? atoi(argv[3]) : 100
+    );
+
+  // --ensemble [members] [bodies per member] [steps]
+  if (argc > 1 && strcmp(argv[1], "--ensemble") == 0)
+    return Headless::ensemble(
+      argc > 2 ? atoi(argv[2]) : 64,
+      argc > 3 ? atoi(argv[3]) : INITIAL_PARTICLES,
+      argc > 4 ? atoi(argv[4]) : 100
+    );
+
+  // --serve [address] [bodies] [steps, 0 runs until killed]
+  if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+    return Headless::serve(
+      argc > 2 ? argv[2] : METRICS_ADDRESS,
+      argc > 3 ? atoi(argv[3]) : INITIAL_PARTICLES,
+      argc > 4 ? atoi(argv[4]) : 0
+    );
+
+  // --out-of-core [bodies] [steps] [budget in MB]
+  if (argc > 1 && strcmp(argv[1], "--out-of-core") == 0)
+    return Headless::outOfCore(
+      argc > 2 ? strtoull(argv[2], nullptr, 10) : INITIAL_PARTICLES,
+      argc > 3 ? atoi(argv[3]) : 10,
+      argc > 4 ? atoi(argv[4]) : OOC_BUDGET_MB
+    );
+
+  // --opencl-devices [bodies] [steps] [compute units per sub-device, 0 keeps the devices whole]
+  if (argc > 1 && strcmp(argv[1], "--opencl-devices") == 0)
+    return Headless::openclDevices(
+      argc > 2 ? atoi(argv[2]) : INITIAL_PARTICLES,
+      argc > 3 ? atoi(argv[3]) : 100,
+      argc > 4 ? atoi(argv[4]) : 1
+    );
 
-int main() {
   App app;
 
   app.run();
@@ -2,5 +2,4 @@
 #include "SFML/Graphics.hpp"
 #include "SFML/Window.hpp"
 #include "SFML/System.hpp"
-#include "preferences.hpp"
-#include "utils/utils.hpp"
+#include "core.hpp"
@@ -7,13 +7,90 @@
 #define SPIRAL_ARMS_WIDTH 20          // Mini arms in arms
 #define SPIRAL_ARMS_WIDTH_VALUE 2.f   // Distance between each mini arm (pi divider)
 #define SPIRAL_ARM_TWIST_VALUE 100.f  // How much the arm is twisted (pi divider)
-#define SPIRAL_ARM_LENGTH (int)(INITIAL_PARTICLES / SPIRAL_ARMS / SPIRAL_ARMS_WIDTH)
 #define ZERO_DIVISION_PREVENT_VALUE 0.1f
 
 #define RADIUS 1
 #define CIRCLE_TEXTURE_SIZE 1024
 #define INITIAL_MASS 1.f
 
+#define SPAWN_CLOUD_BODIES 50        // Added every frame while the left button is held
+#define SPAWN_CLOUD_RADIUS 15.f
+#define ESCAPE_DISTANCE 3000.f       // From the center, bodies past it are removed while X is on
+
+#define MERGE_RADIUS 0.5f
+#define MERGE_REPORT_INTERVAL 500     // Steps between N and step time reports while merging
+
+#define DIAGNOSTICS_INTERVAL 100     // Steps between energy and momentum measurements
+#define DIAGNOSTICS_FILE "diagnostics.csv"
+
+#define PIN_THREADS false            // Pin workers and first-touch particle and tree memory per NUMA node
+#define TREE_SPLIT_LEVELS 2           // Levels split up front when the tree is built in parallel (4^n subtrees)
+
+#define ENSEMBLE_CHUNK 2048           // Bodies per force job of an ensemble member
+#define ENSEMBLE_FILE "ensemble.csv"  // Summary of every member after an ensemble run
+
+#define LOD_PIXEL_THRESHOLD 1.f      // Tree nodes narrower than this many pixels are drawn as one splat
+#define CAMERA_ZOOM_STEP 1.1f
+
+#define DENSITY_BODY_INTENSITY 90.f  // Colormap steps one unit of mass adds in the density render mode
+
+#define INTERACTION_LIST_SKIN 0.1f            // Lists are built with theta this much stricter, the margin is what drift may use up
+#define INTERACTION_LIST_MAX_GROWTH 1.3f      // Rebuild once drift made the lists this much longer than when built
+#define INTERACTION_LIST_REPORT_INTERVAL 200  // Steps between time saved and accuracy reports of the cached lists
+#define INTERACTION_LIST_SAMPLES 256          // Bodies checked against the direct sum in a report
+
+#define AUTOTUNE true                 // Time the engines at startup and when N or the clustering change, run the fastest
+#define AUTOTUNE_FILE "autotune.txt"  // Timings per machine and workload, so each is only measured once
+#define AUTOTUNE_WARMUP_STEPS 1
+#define AUTOTUNE_STEPS 3              // Timed steps per candidate, the median is kept
+#define AUTOTUNE_DT 0.01f
+#define AUTOTUNE_CUTOFF 4.f           // Candidates whose warm up step is this much slower than the best are not timed further
+#define AUTOTUNE_CHECK_INTERVAL 100   // Steps between workload checks while N does not change
+#define AUTOTUNE_DIRECT_MAX_BODIES 20000
+
+#define TASK_GRAPH true                // Integrate and write the quads of every chunk of bodies once no force pass reads them, no barrier in between
+#define TASK_GRAPH_CHUNKS_PER_WORKER 16 // Finer chunks depend on fewer force passes each
+#define TASK_GRAPH_REPORT_INTERVAL 500  // Steps between wall, work and critical path reports of the graph
+
+#define HILBERT_REORDER true         // Sort the bodies along a Hilbert curve whenever the force pass lost more to their drift than a sort costs
+#define HILBERT_MIN_INTERVAL 10       // Steps at least between two sorts, so noise in the timings does not trigger them
+#define HILBERT_REPORT_INTERVAL 500   // Steps at least between force time and cache miss reports before and after a sort
+
+#define OPENCL_MULTI_DEVICE false     // Split the OpenCL step between every device of the platform that has the most
+#define OPENCL_SUB_DEVICE_UNITS 0     // Compute units of the sub-devices the devices are split into in that mode, 0 keeps them whole
+#define OPENCL_BALANCE_SMOOTHING 0.25f // Weight of the last step in the speed a device's share follows
+#define OPENCL_REPORT_INTERVAL 500    // Steps between reports of the bodies and speed of every device
+
+#define PERF_OVERLAY_WINDOW 240       // Frames the percentiles of the overlay are taken over
+#define PERF_OVERLAY_REFRESH 0.25f    // Seconds between updates of its text
+
+#define TRACING 0                     // 1 compiles in the timeline tracing, T records TRACE_FRAMES frames
+#define TRACE_FRAMES 10
+#define TRACE_FILE "trace.json"       // Chrome trace, opens in chrome://tracing or ui.perfetto.dev
+#define TRACE_BUFFER_SPANS (1 << 16)  // Per thread, spans past it are dropped
+
+#define METRICS false                 // Serve the step counters in the Prometheus text format while the window is open
+#define METRICS_ADDRESS "127.0.0.1:9464" // "host:port" or "unix:/path", --serve takes its own
+#define METRICS_MAX 64                // Metrics the registry holds
+#define METRICS_HISTOGRAM_START 1e-5  // Seconds of the first histogram bucket, the next ones double it
+#define METRICS_HISTOGRAM_BUCKETS 20
+
+#define OOC_FILE "bodies.ooc"         // Memory-mapped state of --out-of-core runs, removed when they end
+#define OOC_BUDGET_MB 256             // Resident bodies of a run, the coarse tree and the file's page cache are not counted
+#define OOC_RESIDENT_TILES 24         // Tiles the budget is split between, a tile's near ones and the next tile's
+#define OOC_MIN_TILE_BODIES 1024
+#define OOC_TILE_CELLS 8              // Cells per side of the grid of moments kept in memory for every tile
+#define OOC_GROUP_FANOUT 8            // Tiles per group of the coarse tree, then groups per group
+#define OOC_SORT_INTERVAL 20          // Steps between two sorts into tiles, they grow and overlap as the bodies move
+#define OOC_SORT_SAMPLES 65536        // Bodies whose keys place the tile boundaries
+#define OOC_ERROR_SAMPLES 256         // Bodies checked against the direct sum
+#define OOC_RELEASE_BLOCK (2 << 20)   // Bytes released pages are rounded out to, faults map whole folios of the page cache
+#define OOC_MEMORY_BODY_BYTES 256     // Estimate of what the in-memory engine holds per body: particle, quad, tree, lists
+
+#define FAR_FIELD_SAMPLES 4096       // Bodies sampled for the quantiles the root is fit to
+#define FAR_FIELD_QUANTILE 0.001f     // Share of the samples on each side of the quantiles
+#define FAR_FIELD_MARGIN 1.f          // The root reaches this many quantile spans past them, bodies beyond go to the far field
+
 #define QUAD_TREE_MAX_DEPTH 0xfff
 #define QUAD_TREE_THETA 0.5f
 #define QUAD_TREE_CONTAINER_LIMIT 10
@@ -1,7 +1,7 @@
-#define ZERO_DIVISION_PREVENT_VALUE 0.1f
+#define VERTEX_FLOATS 5 // nb::Vertex: position, color (4 bytes), texture coordinates
 
-__kernel void attraction(float dt, const int n, __global float4* before, __global float4* after) {
-  int globalId = get_global_id(0);
+// Body as x, y, vx, vy. Same force and integration as Particle::attractTo and Particle::update on the CPU.
+float4 advance(float dt, float softening, const int n, int globalId, __global const float* masses, __global const float4* before) {
   float4 p1 = before[globalId];
 
   float accelerationX = 0.f;
@@ -14,23 +14,45 @@ __kernel void attraction(float dt, const int n, __global float4* before, __globa
       float dx = p2.x - p1.x;
       float dy = p2.y - p1.y;
 
-      float dist= sqrt(dx * dx + dy * dy);
-      float distInv = 1.f / (dist + ZERO_DIVISION_PREVENT_VALUE);
-      float distInv3 = distInv * distInv * distInv;
+      float magSq = dx * dx + dy * dy;
+      float factor = masses[j] / (magSq * sqrt(magSq) + softening);
 
-      accelerationX += dx * distInv3;
-      accelerationY += dy * distInv3;
+      accelerationX += factor * dx;
+      accelerationY += factor * dy;
     }
   }
 
-  // Calculate velocity
-  p1.z += accelerationX * dt * dt;
-  p1.w += accelerationY * dt * dt;
+  // Position from the velocity before this step, then the velocity
+  p1.x += p1.z * dt;
+  p1.y += p1.w * dt;
+  p1.z += accelerationX * dt;
+  p1.w += accelerationY * dt;
+
+  return p1;
+}
 
-  // Add velocity to the position
-  p1.x += p1.z;
-  p1.y += p1.w;
+__kernel void attraction(float dt, float softening, const int n, __global const float* masses,
+                         __global const float4* before, __global float4* after) {
+  int globalId = get_global_id(0);
+  if (globalId >= n) return;
 
-  after[globalId] = p1;
+  after[globalId] = advance(dt, softening, n, globalId, masses, before);
 }
 
+// Same step, also writing the quad of the body where SFML reads it, only the positions of the vertices change
+__kernel void attractionVertices(float dt, float softening, const int n, __global const float* masses,
+                                 __global const float4* before, __global float4* after,
+                                 __global const float* radii, __global float* vertices) {
+  int globalId = get_global_id(0);
+  if (globalId >= n) return;
+
+  float4 p = advance(dt, softening, n, globalId, masses, before);
+  after[globalId] = p;
+
+  float r = radii[globalId];
+  __global float* quad = vertices + globalId * 4 * VERTEX_FLOATS;
+  quad[0 * VERTEX_FLOATS + 0] = p.x - r; quad[0 * VERTEX_FLOATS + 1] = p.y - r;
+  quad[1 * VERTEX_FLOATS + 0] = p.x + r; quad[1 * VERTEX_FLOATS + 1] = p.y - r;
+  quad[2 * VERTEX_FLOATS + 0] = p.x + r; quad[2 * VERTEX_FLOATS + 1] = p.y + r;
+  quad[3 * VERTEX_FLOATS + 0] = p.x - r; quad[3 * VERTEX_FLOATS + 1] = p.y + r;
+}
@@ -0,0 +1,48 @@
+#include <cassert>
+#include <cstring>
+
+#include "Arena.hpp"
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+#define ARENA_ALIGNMENT alignof(std::max_align_t)
+
+static thread_local Arena* currentArena = nullptr;
+
+Arena::~Arena() {
+  for (char* b : blocks)
+    delete[] b;
+}
+
+void* Arena::allocate(size_t size) {
+  size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  assert(size <= ARENA_BLOCK_SIZE);
+
+  if (blocks.empty() || offset + size > ARENA_BLOCK_SIZE) {
+    if (!blocks.empty()) block++;
+    offset = 0;
+
+    if (block == blocks.size()) {
+      char* b = new char[ARENA_BLOCK_SIZE];
+      memset(b, 0, ARENA_BLOCK_SIZE);
+      blocks.push_back(b);
+    }
+  }
+
+  void* p = blocks[block] + offset;
+  offset += size;
+
+  return p;
+}
+
+void Arena::reset() {
+  block = 0;
+  offset = 0;
+}
+
+Arena* Arena::current() {
+  return currentArena;
+}
+
+void Arena::setCurrent(Arena* arena) {
+  currentArena = arena;
+}
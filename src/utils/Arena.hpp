@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator of one worker. Blocks are allocated and zeroed by the thread that owns the arena,
+// so on NUMA machines the pages are first touched on that thread's node.
+class Arena {
+  public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    ~Arena();
+
+    void* allocate(size_t size);
+
+    // Frees everything at once, the blocks are kept for the next use
+    void reset();
+
+    // Arena the calling thread allocates tree nodes from, nullptr for the heap
+    static Arena* current();
+    static void setCurrent(Arena* arena);
+
+  private:
+    std::vector<char*> blocks;
+    size_t block = 0;  // Block in use
+    size_t offset = 0; // Bytes used in that block
+};
@@ -0,0 +1,275 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "Metrics.hpp"
+
+#ifdef __unix__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace metrics;
+
+// Published by the count after the metric is constructed, so a scrape only ever sees whole metrics
+static Metric* registry[METRICS_MAX];
+static std::atomic<uint32_t> registered = 0;
+static std::mutex registryMutex;
+
+static std::thread server;
+static std::atomic<bool> serving = false;
+static int listener = -1;
+static std::string socketPath; // Unlinked again when a Unix socket stops
+
+template<class M, class... Args>
+static M& add(Args... args) {
+  std::lock_guard<std::mutex> lock(registryMutex);
+  uint32_t index = registered.load(std::memory_order_relaxed);
+  if (index == METRICS_MAX) {
+    printf("More than %d metrics, raise METRICS_MAX\n", METRICS_MAX);
+    std::abort();
+  }
+
+  M* metric = new M(args...);
+  registry[index] = metric;
+  registered.store(index + 1, std::memory_order_release);
+  return *metric;
+}
+
+// One sample line, labels merged with the extra one (le of a bucket)
+static void sample(std::string& out, const char* name, const char* suffix, const char* labels, const char* extra, double value) {
+  char line[256];
+  const char* comma = labels[0] && extra[0] ? "," : "";
+  if (labels[0] || extra[0]) snprintf(line, sizeof(line), "%s%s{%s%s%s} %.9g\n", name, suffix, labels, comma, extra, value);
+  else snprintf(line, sizeof(line), "%s%s %.9g\n", name, suffix, value);
+  out += line;
+}
+
+Metric::Metric(const char* name, const char* help, const char* labels) : name(name), help(help), labels(labels) {}
+
+Counter::Counter(const char* name, const char* help, const char* labels, double scale)
+  : Metric(name, help, labels), scale(scale) {}
+
+void Counter::add(uint64_t amount) {
+  value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+void Counter::write(std::string& out) const {
+  sample(out, name, "", labels, "", value.load(std::memory_order_relaxed) * scale);
+}
+
+const char* Counter::type() const {
+  return "counter";
+}
+
+Gauge::Gauge(const char* name, const char* help, const char* labels) : Metric(name, help, labels) {}
+
+void Gauge::set(double v) {
+  value.store(v, std::memory_order_relaxed);
+}
+
+void Gauge::write(std::string& out) const {
+  sample(out, name, "", labels, "", value.load(std::memory_order_relaxed));
+}
+
+const char* Gauge::type() const {
+  return "gauge";
+}
+
+Histogram::Histogram(const char* name, const char* help, const char* labels) : Metric(name, help, labels) {}
+
+void Histogram::observe(double seconds) {
+  int bucket = 0;
+  for (double bound = METRICS_HISTOGRAM_START; bucket < METRICS_HISTOGRAM_BUCKETS && seconds > bound; bound *= 2.0)
+    bucket++;
+
+  buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(seconds, std::memory_order_relaxed);
+}
+
+void Histogram::write(std::string& out) const {
+  // Cumulated here, the count is the last bucket so the two always agree
+  uint64_t cumulative = 0;
+  double bound = METRICS_HISTOGRAM_START;
+  char le[32];
+
+  for (int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++, bound *= 2.0) {
+    cumulative += buckets[i].load(std::memory_order_relaxed);
+    snprintf(le, sizeof(le), "le=\"%.9g\"", bound);
+    sample(out, name, "_bucket", labels, le, cumulative);
+  }
+
+  cumulative += buckets[METRICS_HISTOGRAM_BUCKETS].load(std::memory_order_relaxed);
+  sample(out, name, "_bucket", labels, "le=\"+Inf\"", cumulative);
+  sample(out, name, "_sum", labels, "", sum.load(std::memory_order_relaxed));
+  sample(out, name, "_count", labels, "", cumulative);
+}
+
+const char* Histogram::type() const {
+  return "histogram";
+}
+
+Counter& metrics::counter(const char* name, const char* help, const char* labels, double scale) {
+  return add<Counter>(name, help, labels, scale);
+}
+
+Gauge& metrics::gauge(const char* name, const char* help, const char* labels) {
+  return add<Gauge>(name, help, labels);
+}
+
+Histogram& metrics::histogram(const char* name, const char* help, const char* labels) {
+  return add<Histogram>(name, help, labels);
+}
+
+std::string metrics::scrape() {
+  std::string out;
+  const uint32_t count = registered.load(std::memory_order_acquire);
+
+  for (uint32_t i = 0; i < count; i++) {
+    const Metric& m = *registry[i];
+    if (i == 0 || strcmp(registry[i - 1]->name, m.name) != 0) {
+      out += "# HELP "; out += m.name; out += ' '; out += m.help; out += '\n';
+      out += "# TYPE "; out += m.name; out += ' '; out += m.type(); out += '\n';
+    }
+    m.write(out);
+  }
+
+  return out;
+}
+
+#ifdef __unix__
+
+// Request line of one connection, then the answer. A client that sends nothing is dropped after the timeout.
+static void answer(int fd) {
+  timeval timeout{1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  char request[1024];
+  size_t length = 0;
+  while (length < sizeof(request) - 1) {
+    ssize_t got = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+    if (got <= 0) break;
+    length += got;
+    request[length] = '\0';
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+  }
+  request[length] = '\0';
+
+  std::string body, status = "200 OK";
+  if (strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0) {
+    body = scrape();
+  } else {
+    status = "404 Not Found";
+    body = "Metrics are at /metrics\n";
+  }
+
+  std::string response =
+    "HTTP/1.0 " + status + "\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Content-Length: " + std::to_string(body.size()) + "\r\n"
+    "Connection: close\r\n\r\n" + body;
+
+  for (size_t sent = 0; sent < response.size();) {
+    ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) break;
+    sent += n;
+  }
+  close(fd);
+}
+
+static void serverLoop() {
+  while (serving.load(std::memory_order_relaxed)) {
+    pollfd p{listener, POLLIN, 0};
+    if (poll(&p, 1, 100) <= 0) continue;
+
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd >= 0) answer(fd);
+  }
+}
+
+static int listenOn(const char* address) {
+  if (strncmp(address, "unix:", 5) == 0) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, address + 5, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(addr.sun_path); // Left over by a run that did not stop
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+
+    socketPath = addr.sun_path;
+    return fd;
+  }
+
+  // "port" or "host:port", the host being a numeric IPv4 address
+  std::string host = "127.0.0.1";
+  const char* colon = strrchr(address, ':');
+  if (colon) host.assign(address, colon - address);
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(colon ? colon + 1 : address));
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+    if (fd >= 0) close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool metrics::serve(const char* address) {
+  if (serving) stop();
+
+  listener = listenOn(address);
+  if (listener < 0) {
+    printf("Metrics could not listen on %s\n", address);
+    return false;
+  }
+
+  serving = true;
+  server = std::thread(serverLoop);
+  printf("Metrics served on %s\n", address);
+  return true;
+}
+
+void metrics::stop() {
+  if (!serving) return;
+
+  serving = false;
+  server.join();
+  close(listener);
+  listener = -1;
+
+  if (!socketPath.empty()) unlink(socketPath.c_str());
+  socketPath.clear();
+}
+
+#else
+
+bool metrics::serve(const char* address) {
+  printf("Metrics can only be served on Unix hosts, %s is not listened on\n", address);
+  return false;
+}
+
+void metrics::stop() {}
+
+#endif
+
+bool metrics::isServing() {
+  return serving.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Counters, gauges and histograms of the whole process, served in the Prometheus text format. Updates are relaxed
+// atomics and the registry only ever grows, so neither the simulation nor the workers wait on a scrape. Registration
+// locks, it is meant for startup.
+namespace metrics {
+  class Metric {
+    public:
+      Metric(const char* name, const char* help, const char* labels); // String literals, only the pointers are kept
+      virtual ~Metric() = default;
+
+      // Samples in the text format, the HELP and TYPE lines are written once per name by the caller
+      virtual void write(std::string& out) const = 0;
+      [[nodiscard]] virtual const char* type() const = 0;
+
+      const char* name;
+      const char* help;
+      const char* labels; // Like phase="tree", or empty
+  };
+
+  // Only goes up. Scale converts what is added to the unit of the name, like nanoseconds to seconds.
+  class Counter : public Metric {
+    public:
+      Counter(const char* name, const char* help, const char* labels, double scale);
+      void add(uint64_t amount = 1);
+
+      void write(std::string& out) const override;
+      [[nodiscard]] const char* type() const override;
+
+    private:
+      std::atomic<uint64_t> value = 0;
+      double scale;
+  };
+
+  class Gauge : public Metric {
+    public:
+      Gauge(const char* name, const char* help, const char* labels);
+      void set(double v);
+
+      void write(std::string& out) const override;
+      [[nodiscard]] const char* type() const override;
+
+    private:
+      std::atomic<double> value = 0.0;
+  };
+
+  // Buckets doubling from METRICS_HISTOGRAM_START, in seconds
+  class Histogram : public Metric {
+    public:
+      Histogram(const char* name, const char* help, const char* labels);
+      void observe(double seconds);
+
+      void write(std::string& out) const override;
+      [[nodiscard]] const char* type() const override;
+
+    private:
+      std::atomic<uint64_t> buckets[METRICS_HISTOGRAM_BUCKETS + 1] = {}; // Not cumulative, the last one is +Inf
+      std::atomic<double> sum = 0.0;
+  };
+
+  // Registered for the life of the process. Metrics of one name must be registered one after the other.
+  Counter& counter(const char* name, const char* help, const char* labels = "", double scale = 1.0);
+  Gauge& gauge(const char* name, const char* help, const char* labels = "");
+  Histogram& histogram(const char* name, const char* help, const char* labels = "");
+
+  // Every metric registered so far in the text format
+  std::string scrape();
+
+  // Answers HTTP GET /metrics on a thread of its own. "host:port" listens on TCP (localhost unless a host is given),
+  // "unix:/path" on a Unix socket. False if it could not listen.
+  bool serve(const char* address);
+  void stop();
+
+  [[nodiscard]] bool isServing();
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <mutex>
+
+#include "PerfCounters.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PERF_CACHE_READ(cache, result) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((result) << 16))
+
+// In the order of Reading
+static const uint64_t configs[] = {
+  PERF_CACHE_READ(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_ACCESS),
+  PERF_CACHE_READ(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS),
+  PERF_CACHE_READ(PERF_COUNT_HW_CACHE_LL,  PERF_COUNT_HW_CACHE_RESULT_ACCESS),
+  PERF_CACHE_READ(PERF_COUNT_HW_CACHE_LL,  PERF_COUNT_HW_CACHE_RESULT_MISS)
+};
+static const int counterCount = sizeof(configs) / sizeof(configs[0]);
+
+// Counters of the calling thread as one group, read together. -1 if one of them is not supported.
+static int openGroup(std::vector<int>& fds) {
+  int leader = -1;
+  std::vector<int> own;
+
+  for (int i = 0; i < counterCount; i++) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = configs[i];
+    attr.disabled = i == 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+    if (fd < 0) {
+      for (int f : own) close(f);
+      return -1;
+    }
+
+    own.push_back(fd);
+    if (i == 0) leader = fd;
+  }
+
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  fds.insert(fds.end(), own.begin(), own.end());
+  return leader;
+}
+#endif
+
+PerfCounters::Reading PerfCounters::Reading::operator-(const Reading& r) const {
+  return {l1Accesses - r.l1Accesses, l1Misses - r.l1Misses, llcAccesses - r.llcAccesses, llcMisses - r.llcMisses};
+}
+
+double PerfCounters::Reading::l1MissRate() const {
+  return l1Accesses ? static_cast<double>(l1Misses) / l1Accesses : 0.0;
+}
+
+double PerfCounters::Reading::llcMissRate() const {
+  return llcAccesses ? static_cast<double>(llcMisses) / llcAccesses : 0.0;
+}
+
+PerfCounters::PerfCounters(ThreadPool& tp) {
+  leaders.assign(tp.size(), -1);
+
+#if defined(__linux__)
+  std::mutex fdsMutex;
+  for (uint32_t w = 0; w < static_cast<uint32_t>(tp.size()); w++)
+    tp.queueJob(w, [this, w, &fdsMutex] {
+      std::vector<int> own;
+      int leader = openGroup(own);
+
+      std::lock_guard<std::mutex> lock(fdsMutex);
+      leaders[w] = leader;
+      fds.insert(fds.end(), own.begin(), own.end());
+    });
+  tp.waitForCompletion();
+
+  available = std::none_of(leaders.begin(), leaders.end(), [](int fd) { return fd < 0; });
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+  for (int fd : fds) close(fd);
+#endif
+}
+
+bool PerfCounters::isAvailable() const {
+  return available;
+}
+
+PerfCounters::Reading PerfCounters::read() const {
+  Reading sum;
+  if (!available) return sum;
+
+#if defined(__linux__)
+  for (int leader : leaders) {
+    uint64_t values[1 + counterCount]; // Count, then the counters in the order they were opened
+    if (::read(leader, values, sizeof(values)) != sizeof(values)) continue;
+
+    sum.l1Accesses += values[1];
+    sum.l1Misses += values[2];
+    sum.llcAccesses += values[3];
+    sum.llcMisses += values[4];
+  }
+#endif
+
+  return sum;
+}
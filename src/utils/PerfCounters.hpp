@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+// Cache counters of every worker of a pool, from perf_event_open on Linux. Elsewhere, or when the kernel does not
+// allow it, isAvailable is false and every reading is zero.
+class PerfCounters {
+  public:
+    struct Reading {
+      uint64_t l1Accesses = 0;
+      uint64_t l1Misses = 0;
+      uint64_t llcAccesses = 0;
+      uint64_t llcMisses = 0;
+
+      Reading operator-(const Reading& r) const;
+      [[nodiscard]] double l1MissRate() const;
+      [[nodiscard]] double llcMissRate() const;
+    };
+
+    // Every worker opens its own counters, the pool must be idle
+    explicit PerfCounters(ThreadPool& tp);
+    PerfCounters(const PerfCounters&) = delete;
+    ~PerfCounters();
+
+    [[nodiscard]] bool isAvailable() const;
+
+    // Summed over the workers since they were opened
+    [[nodiscard]] Reading read() const;
+
+  private:
+    std::vector<int> leaders; // Group of every worker, -1 where it could not be opened
+    std::vector<int> fds;     // Every counter, to close them
+    bool available = false;
+};
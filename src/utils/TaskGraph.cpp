@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cassert>
+
+#include "TaskGraph.hpp"
+
+uint32_t TaskGraph::add(const std::function<void()>& job, int worker) {
+  tasks.push_back({job, worker});
+  return tasks.size() - 1;
+}
+
+void TaskGraph::depend(uint32_t task, uint32_t on) {
+  assert(on < task);
+  tasks[on].successors.push_back(task);
+  tasks[task].predecessors++;
+  edgeCount++;
+}
+
+void TaskGraph::run(ThreadPool& tp) {
+  if (pendingSize < tasks.size()) {
+    pendingSize = tasks.size();
+    pending.reset(new std::atomic<uint32_t>[pendingSize]);
+  }
+  for (size_t i = 0; i < tasks.size(); i++)
+    pending[i].store(tasks[i].predecessors, std::memory_order_relaxed);
+
+  // Successors are queued from inside the jobs, before those count as done, so the pool never looks idle in between
+  start = Clock::now();
+  for (size_t i = 0; i < tasks.size(); i++)
+    if (tasks[i].predecessors == 0) launch(i, tp);
+  tp.waitForCompletion();
+  finish = Clock::now();
+}
+
+void TaskGraph::clear() {
+  tasks.clear();
+  edgeCount = 0;
+}
+
+size_t TaskGraph::size() const {
+  return tasks.size();
+}
+
+size_t TaskGraph::edges() const {
+  return edgeCount;
+}
+
+float TaskGraph::wall() const {
+  return std::chrono::duration<float>(finish - start).count();
+}
+
+float TaskGraph::work() const {
+  float sum = 0.f;
+  for (const Task& t : tasks)
+    sum += std::chrono::duration<float>(t.end - t.begin).count();
+  return sum;
+}
+
+float TaskGraph::criticalPath() const {
+  // Tasks only depend on earlier ones, so the order they were added in is a topological order
+  std::vector<float> longest(tasks.size(), 0.f); // Up to the start of the task
+  float path = 0.f;
+
+  for (size_t i = 0; i < tasks.size(); i++) {
+    float through = longest[i] + std::chrono::duration<float>(tasks[i].end - tasks[i].begin).count();
+    for (uint32_t s : tasks[i].successors)
+      longest[s] = std::max(longest[s], through);
+    path = std::max(path, through);
+  }
+
+  return path;
+}
+
+float TaskGraph::finishedAt(uint32_t task) const {
+  return std::chrono::duration<float>(tasks[task].end - start).count();
+}
+
+void TaskGraph::launch(uint32_t task, ThreadPool& tp) {
+  int worker = tasks[task].worker;
+  if (tp.isPinned() && worker >= 0) tp.queueJob(worker, [this, task, &tp] { execute(task, tp); });
+  else tp.queueJob([this, task, &tp] { execute(task, tp); });
+}
+
+void TaskGraph::execute(uint32_t task, ThreadPool& tp) {
+  Task& t = tasks[task];
+  t.begin = Clock::now();
+  t.job();
+  t.end = Clock::now();
+
+  for (uint32_t s : t.successors)
+    if (pending[s].fetch_sub(1, std::memory_order_acq_rel) == 1)
+      launch(s, tp);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+// Jobs with dependencies, every one queued on the pool by the last of its predecessors to finish rather than after a
+// barrier. Built anew for every run, the time every job took is kept so the critical path can be measured.
+class TaskGraph {
+  public:
+    // Index of the new task. On pinned pools it runs on that worker, -1 lets any worker take it.
+    uint32_t add(const std::function<void()>& job, int worker = -1);
+
+    // Task runs once on has finished, which must have been added before it
+    void depend(uint32_t task, uint32_t on);
+
+    // Every task, returns once the last one finished
+    void run(ThreadPool& tp);
+    void clear();
+
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] size_t edges() const;
+
+    // Seconds, of the last run
+    [[nodiscard]] float wall() const;
+    [[nodiscard]] float work() const;               // Summed over the tasks
+    [[nodiscard]] float criticalPath() const;       // Longest chain of dependent tasks, by what they took
+    [[nodiscard]] float finishedAt(uint32_t task) const; // Since the start of the run
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Task {
+      std::function<void()> job;
+      int worker = -1;
+      std::vector<uint32_t> successors{};
+      uint32_t predecessors = 0;
+      Clock::time_point begin{}, end{};
+    };
+
+    std::vector<Task> tasks;
+    std::unique_ptr<std::atomic<uint32_t>[]> pending; // Predecessors yet to finish, per task
+    size_t pendingSize = 0;
+    size_t edgeCount = 0;
+    Clock::time_point start, finish;
+
+  private:
+    void launch(uint32_t task, ThreadPool& tp);
+    void execute(uint32_t task, ThreadPool& tp);
+};
@@ -1,40 +1,167 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "Metrics.hpp"
 #include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+static thread_local int currentWorker = -1;
+
+// Summed over every pool, utilization is their rate over the workers
+static metrics::Counter& jobsDone = metrics::counter("nbody_pool_jobs_total", "Jobs run by the workers of every pool");
+static metrics::Counter& busySeconds = metrics::counter("nbody_pool_busy_seconds_total", "Time the workers of every pool spent in jobs", "", 1e-9);
+
+struct Cpu {
+  uint32_t id;
+  uint32_t node;
+};
+
+// Cpus this process may run on, sorted by NUMA node. Single node (or unknown topology) hosts get node 0 everywhere.
+static std::vector<Cpu> cpuTopology() {
+  std::vector<Cpu> cpus;
+
+#if defined(__linux__)
+  // cpulist of every node looks like "0-15,32-47"
+  std::vector<uint32_t> nodeOfCpu(CPU_SETSIZE, 0);
+  for (uint32_t node = 0; node < 64; node++) {
+    std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string range;
+    while (std::getline(cpulist, range, ',')) {
+      uint32_t first = 0, last = 0;
+      int parsed = sscanf(range.c_str(), "%u-%u", &first, &last);
+      if (parsed < 1) continue;
+      if (parsed == 1) last = first;
+      for (uint32_t cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        nodeOfCpu[cpu] = node;
+    }
+  }
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  sched_getaffinity(0, sizeof(set), &set);
+
+  for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &set))
+      cpus.push_back({cpu, nodeOfCpu[cpu]});
+#elif defined(_WIN32)
+  DWORD_PTR processMask, systemMask;
+  GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask);
+
+  for (uint32_t cpu = 0; cpu < sizeof(DWORD_PTR) * 8; cpu++) {
+    if (!(processMask & (DWORD_PTR(1) << cpu))) continue;
+
+    UCHAR node = 0;
+    GetNumaProcessorNode(static_cast<UCHAR>(cpu), &node);
+    cpus.push_back({cpu, node == 0xff ? 0u : node});
+  }
+#endif
+
+  std::stable_sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) { return a.node < b.node; });
+  return cpus;
+}
+
+static bool pinToCpu(uint32_t cpu) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+  return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+  return false;
+#endif
+}
 
 void ThreadPool::wait() {
   std::this_thread::yield();
 }
 
-void ThreadPool::threadLoop() {
+void ThreadPool::threadLoop(uint32_t index) {
+  currentWorker = index;
+  TRACE_THREAD("worker " + std::to_string(index));
+
   while (true) {
     std::function<void()> job;
     {
       std::unique_lock<std::mutex> lock(queueMutex);
-      mutexCondition.wait(lock, [this] {
-        return !jobs.empty() || shouldTerminate;
+      mutexCondition.wait(lock, [this, index] {
+        return !workerJobs[index].empty() || !jobs.empty() || shouldTerminate;
       });
       if (shouldTerminate)
         return;
-      job = jobs.front();
-      jobs.pop();
+
+      std::queue<std::function<void()>>& queue = workerJobs[index].empty() ? jobs : workerJobs[index];
+      job = queue.front();
+      queue.pop();
+    }
+    {
+      TRACE_SCOPE("job");
+      auto begin = std::chrono::steady_clock::now();
+      job();
+      uint64_t busy = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+      busyNanoseconds.fetch_add(busy, std::memory_order_relaxed);
+      busySeconds.add(busy);
+      jobsDone.add();
     }
-    job();
     remainingTasks--;
   }
 }
 
 void ThreadPool::start() {
-  const uint32_t numThreads = std::thread::hardware_concurrency();
-  for (uint32_t ii = 0; ii < numThreads; ++ii)
-    threads.emplace_back(std::thread(&ThreadPool::threadLoop, this));
+  start(std::thread::hardware_concurrency(), false);
 }
 
 void ThreadPool::start(uint32_t limit) {
-  const uint32_t numThreads = std::min(limit, std::thread::hardware_concurrency());
-  for (uint32_t ii = 0; ii < numThreads; ++ii)
-    threads.emplace_back(std::thread(&ThreadPool::threadLoop, this));
+  start(limit, false);
+}
+
+void ThreadPool::start(uint32_t limit, bool pin) {
+  const uint32_t numThreads = std::max(1u, std::min(limit, std::thread::hardware_concurrency()));
+  const std::vector<Cpu> cpus = pin ? cpuTopology() : std::vector<Cpu>{};
+
+  pinned = pin && !cpus.empty();
+  if (pin && !pinned)
+    printf("Thread pinning is not supported here, workers will float\n");
+
+  workerJobs.resize(numThreads);
+  arenas = std::vector<Arena>(numThreads);
+  workerNodes.assign(numThreads, 0);
+
+  for (uint32_t ii = 0; ii < numThreads; ++ii) {
+    if (pinned) workerNodes[ii] = cpus[ii % cpus.size()].node;
+
+    threads.emplace_back(std::thread([this, ii, cpus] {
+      if (pinned && !pinToCpu(cpus[ii % cpus.size()].id))
+        printf("Worker %u could not be pinned\n", ii);
+      threadLoop(ii);
+    }));
+  }
+}
+
+void ThreadPool::startSerial() {
+  serial = true;
+  workerJobs.resize(1);
+  arenas = std::vector<Arena>(1);
+  workerNodes.assign(1, 0);
 }
 
 void ThreadPool::queueJob(const std::function<void()>& job) {
+  if (serial) {
+    job();
+    return;
+  }
+
   {
     std::unique_lock<std::mutex> lock(queueMutex);
     jobs.push(job);
@@ -43,6 +170,21 @@ void ThreadPool::queueJob(const std::function<void()>& job) {
   mutexCondition.notify_one();
 }
 
+void ThreadPool::queueJob(uint32_t worker, const std::function<void()>& job) {
+  if (serial) {
+    job();
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    workerJobs[worker].push(job);
+    remainingTasks++;
+  }
+  // The one waiting thread woken by notify_one may not be the right worker
+  mutexCondition.notify_all();
+}
+
 void ThreadPool::waitForCompletion() const {
   while (remainingTasks > 0)
     wait();
@@ -61,8 +203,53 @@ void ThreadPool::stop() {
   threads.clear();
 }
 
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t, uint32_t)>& job) {
+  const uint32_t slices = size();
+  const size_t slice = count / slices;
+
+  for (uint32_t i = 0; i < slices; i++) {
+    size_t begin = i * slice;
+    size_t end = i == slices - 1 ? count : begin + slice;
+
+    if (pinned) queueJob(i, [&job, begin, end, i] {job(begin, end, i);});
+    else queueJob([&job, begin, end, i] {job(begin, end, i);});
+  }
+  waitForCompletion();
+}
+
+void ThreadPool::firstTouch(void* memory, size_t bytes) {
+  char* bytesPtr = static_cast<char*>(memory);
+  parallelFor(bytes, [bytesPtr](size_t begin, size_t end, uint32_t) {
+    memset(bytesPtr + begin, 0, end - begin);
+  });
+}
+
+Arena& ThreadPool::arena(uint32_t worker) {
+  return arenas[worker];
+}
+
+void ThreadPool::resetArenas() {
+  for (Arena& arena : arenas)
+    arena.reset();
+}
+
 // Threads amount
 const int ThreadPool::size() const {
-  return threads.size();
+  return serial ? 1 : threads.size();
 }
 
+bool ThreadPool::isPinned() const {
+  return pinned;
+}
+
+uint64_t ThreadPool::busyTime() const {
+  return busyNanoseconds.load(std::memory_order_relaxed);
+}
+
+uint32_t ThreadPool::nodeOf(uint32_t worker) const {
+  return workerNodes[worker];
+}
+
+int ThreadPool::workerIndex() {
+  return currentWorker;
+}
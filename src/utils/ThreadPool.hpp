@@ -5,6 +5,7 @@
  * https://github.com/johnBuffer/VerletSFML-Multithread/blob/main/src/thread_pool/thread_pool.hpp
 */
 
+#include <chrono>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
@@ -12,24 +13,55 @@
 #include <queue>
 #include <atomic>
 
+#include "Arena.hpp"
+
 class ThreadPool {
   bool shouldTerminate = false;           // Tells threads to stop looking for jobs
+  bool pinned = false;                    // Workers are bound to one cpu each
+  bool serial = false;                    // No workers, jobs run on the thread queueing them
   std::mutex queueMutex;                  // Prevents data races to the job queue
   std::condition_variable mutexCondition; // Allows threads to wait on new jobs or termination
   std::vector<std::thread> threads;
   std::queue<std::function<void()>> jobs;
+  std::vector<std::queue<std::function<void()>>> workerJobs; // Jobs only a specific worker may take
+  std::vector<Arena> arenas;
+  std::vector<uint32_t> workerNodes;      // NUMA node of every worker
   std::atomic<uint32_t> remainingTasks = 0;
+  std::atomic<uint64_t> busyNanoseconds = 0; // Spent in jobs, summed over the workers
 
   static void wait();
-  void threadLoop();
+  void threadLoop(uint32_t index);
 
   public:
     void start();
     void start(uint32_t limit);
+    // Binds every worker to a cpu, ordered by NUMA node so neighbouring workers share a node
+    void start(uint32_t limit, bool pin);
+    // One slice run by the caller, for systems stepped from the jobs of another pool (which must not wait on itself)
+    void startSerial();
     void queueJob(const std::function<void()>& job);
+    void queueJob(uint32_t worker, const std::function<void()>& job);
     void waitForCompletion() const;
     void stop();
 
+    // Splits [0, count) into one slice per worker. Pinned pools always give slice i to worker i,
+    // so the memory a slice was first touched with stays on the same node.
+    void parallelFor(size_t count, const std::function<void(size_t begin, size_t end, uint32_t slice)>& job);
+
+    // Lets every worker write its slice of a fresh allocation first
+    void firstTouch(void* memory, size_t bytes);
+
+    // Only the owning worker should allocate from its arena
+    Arena& arena(uint32_t worker);
+
+    // Frees the arena allocations of every worker
+    void resetArenas();
+
     const int size() const;
-};
+    [[nodiscard]] bool isPinned() const;
+    [[nodiscard]] uint64_t busyTime() const; // Nanoseconds the workers spent in jobs since the start
+    [[nodiscard]] uint32_t nodeOf(uint32_t worker) const;
 
+    // Index of the calling worker, -1 outside of the pool
+    static int workerIndex();
+};
@@ -0,0 +1,140 @@
+#include "Trace.hpp"
+
+#if TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct Span {
+  const char* name;
+  uint64_t begin; // Nanoseconds since the process started
+  uint64_t end;
+};
+
+// Written by its thread only. The count is published after the span, so the writer sees whole spans.
+struct Buffer {
+  std::string thread;
+  std::unique_ptr<Span[]> spans{new Span[TRACE_BUFFER_SPANS]};
+  std::atomic<uint32_t> count = 0;
+  std::atomic<uint32_t> dropped = 0; // Spans past the capacity
+};
+
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+static std::atomic<bool> recording = false;
+static uint32_t pendingFrames = 0;
+static uint32_t framesLeft = 0;
+
+// Buffers outlive their threads, a worker may be gone by the time the trace is written
+static std::mutex registryMutex;
+static std::vector<std::unique_ptr<Buffer>> buffers;
+static thread_local Buffer* local = nullptr;
+
+static uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// Lock taken once per thread, the first time it names itself or records
+static Buffer* localBuffer() {
+  if (!local) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffers.push_back(std::make_unique<Buffer>());
+    local = buffers.back().get();
+    local->thread = "thread " + std::to_string(buffers.size() - 1);
+  }
+  return local;
+}
+
+static void write() {
+  std::ofstream file(TRACE_FILE);
+  uint32_t total = 0, dropped = 0;
+  bool first = true;
+
+  file << "{\"traceEvents\":[";
+  std::lock_guard<std::mutex> lock(registryMutex);
+  for (size_t tid = 0; tid < buffers.size(); tid++) {
+    const Buffer& b = *buffers[tid];
+    uint32_t count = b.count.load(std::memory_order_acquire);
+    total += count;
+    dropped += b.dropped.load(std::memory_order_relaxed);
+
+    file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+         << ",\"args\":{\"name\":\"" << b.thread << "\"}}";
+    first = false;
+
+    // Chrome wants microseconds, the fraction keeps the short spans apart
+    char event[256];
+    for (uint32_t i = 0; i < count; i++) {
+      const Span& s = b.spans[i];
+      snprintf(event, sizeof(event), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+        s.name, tid, s.begin * 1e-3, (s.end - s.begin) * 1e-3);
+      file << event;
+    }
+  }
+  file << "\n]}\n";
+
+  printf("Trace of %u spans written to %s", total, TRACE_FILE);
+  if (dropped) printf(", %u dropped past %u per thread", dropped, TRACE_BUFFER_SPANS);
+  printf("\n");
+}
+
+trace::Scope::Scope(const char* name)
+  : name(recording.load(std::memory_order_relaxed) ? name : nullptr), begin(this->name ? now() : 0) {
+}
+
+trace::Scope::~Scope() {
+  if (!name || !recording.load(std::memory_order_relaxed)) return;
+
+  Buffer* b = localBuffer();
+  uint32_t i = b->count.load(std::memory_order_relaxed);
+  if (i == TRACE_BUFFER_SPANS) {
+    b->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  b->spans[i] = {name, begin, now()};
+  b->count.store(i + 1, std::memory_order_release);
+}
+
+void trace::nameThread(const std::string& name) {
+  Buffer* b = localBuffer();
+  std::lock_guard<std::mutex> lock(registryMutex);
+  b->thread = name;
+}
+
+void trace::record(uint32_t frames) {
+  if (!recording && frames) pendingFrames = frames;
+}
+
+void trace::frame() {
+  if (pendingFrames) {
+    // No job runs between frames, the buffers are not being written
+    {
+      std::lock_guard<std::mutex> lock(registryMutex);
+      for (const std::unique_ptr<Buffer>& b : buffers) {
+        b->count.store(0, std::memory_order_relaxed);
+        b->dropped.store(0, std::memory_order_relaxed);
+      }
+    }
+    framesLeft = pendingFrames;
+    pendingFrames = 0;
+    recording = true;
+    printf("Tracing %u frames\n", framesLeft);
+    return;
+  }
+
+  if (recording && --framesLeft == 0) {
+    recording = false;
+    write();
+  }
+}
+
+bool trace::isRecording() {
+  return recording || pendingFrames;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Timeline of what every thread did over a few frames, written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+// Each thread appends its spans to a buffer of its own, so recording takes no lock. Everything but the declarations
+// is compiled out unless TRACING is set.
+namespace trace {
+  // Span from construction to destruction, dropped unless recording over its whole length
+  class Scope {
+    public:
+      explicit Scope(const char* name); // String literal, only the pointer is kept
+      ~Scope();
+
+    private:
+      const char* name;
+      uint64_t begin;
+  };
+
+  // Name of the calling thread in the trace
+  void nameThread(const std::string& name);
+
+  // Records from the next frame on and writes the trace after that many frames
+  void record(uint32_t frames);
+
+  // Start of a frame. Called by the thread that drives the frames while no job is running.
+  void frame();
+
+  [[nodiscard]] bool isRecording();
+}
+
+#if TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_THREAD(name) trace::nameThread(name)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+#endif
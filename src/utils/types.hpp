@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Plain value types of the engine, so it builds without SFML. They keep the layout and the operators of their SFML
+// namesakes: the viewer hands the vertices to SFML as they are, without a copy.
+namespace nb {
+  template<class T>
+  struct Vector2 {
+    T x = 0, y = 0;
+
+    constexpr Vector2() = default;
+    constexpr Vector2(T x, T y) : x(x), y(y) {}
+
+    template<class U>
+    constexpr explicit Vector2(const Vector2<U>& v) : x(static_cast<T>(v.x)), y(static_cast<T>(v.y)) {}
+
+    constexpr Vector2& operator+=(const Vector2& v) { x += v.x; y += v.y; return *this; }
+    constexpr Vector2& operator-=(const Vector2& v) { x -= v.x; y -= v.y; return *this; }
+    constexpr Vector2& operator*=(T s) { x *= s; y *= s; return *this; }
+    constexpr Vector2& operator/=(T s) { x /= s; y /= s; return *this; }
+
+    constexpr Vector2 operator-() const { return {-x, -y}; }
+    constexpr Vector2 operator+(const Vector2& v) const { return {x + v.x, y + v.y}; }
+    constexpr Vector2 operator-(const Vector2& v) const { return {x - v.x, y - v.y}; }
+    constexpr Vector2 operator*(T s) const { return {x * s, y * s}; }
+    constexpr Vector2 operator/(T s) const { return {x / s, y / s}; }
+    constexpr friend Vector2 operator*(T s, const Vector2& v) { return {s * v.x, s * v.y}; }
+
+    constexpr bool operator==(const Vector2& v) const { return x == v.x && y == v.y; }
+    constexpr bool operator!=(const Vector2& v) const { return !(*this == v); }
+  };
+
+  using Vector2f = Vector2<float>;
+
+  template<class T>
+  struct Rect {
+    T left = 0, top = 0, width = 0, height = 0;
+
+    constexpr Rect() = default;
+    constexpr Rect(T left, T top, T width, T height) : left(left), top(top), width(width), height(height) {}
+
+    [[nodiscard]] constexpr bool contains(const Vector2<T>& p) const {
+      return p.x >= left && p.x < left + width && p.y >= top && p.y < top + height;
+    }
+  };
+
+  using FloatRect = Rect<float>;
+
+  struct Color {
+    uint8_t r = 0, g = 0, b = 0, a = 255;
+
+    constexpr Color() = default;
+    constexpr Color(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255) : r(r), g(g), b(b), a(a) {}
+  };
+
+  // Corner of a quad
+  struct Vertex {
+    Vector2f position;
+    Color color{255, 255, 255};
+    Vector2f texCoords;
+
+    constexpr Vertex() = default;
+    constexpr Vertex(Vector2f position, Color color, Vector2f texCoords = {})
+      : position(position), color(color), texCoords(texCoords) {}
+  };
+
+  class Time {
+    public:
+      constexpr explicit Time(float seconds = 0.f) : seconds(seconds) {}
+      [[nodiscard]] constexpr float asSeconds() const { return seconds; }
+
+    private:
+      float seconds;
+  };
+
+  class Clock {
+    public:
+      [[nodiscard]] Time getElapsedTime() const {
+        return Time(std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count());
+      }
+
+      Time restart() {
+        auto now = std::chrono::steady_clock::now();
+        Time elapsed(std::chrono::duration<float>(now - start).count());
+        start = now;
+        return elapsed;
+      }
+
+    private:
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  };
+}
@@ -1,6 +1,10 @@
 #pragma once
 
-#include "colormaps.hpp"
 #include "file.hpp"
+#include "Metrics.hpp"
+#include "PerfCounters.hpp"
+#include "TaskGraph.hpp"
 #include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "types.hpp"
 